@@ -0,0 +1,617 @@
+//
+//  bench.cpp
+//
+//  Copyright (c) 2019 2025 Andrea Bondavalli. All rights reserved.
+//
+//  This program is free software: you can redistribute it and/or modify
+//  it under the terms of the MIT license
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+//
+
+#include <algorithm>
+#include <boost/program_options.hpp>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <sstream>
+#include <sys/resource.h>
+#include <vector>
+
+#include "capture.hpp"
+#include "config.hpp"
+#include "convert.hpp"
+#include "log.hpp"
+#include "model.hpp"
+#include "resampler.hpp"
+#include "scheduler.hpp"
+#include "segmenter.hpp"
+#include "whisper.hpp"
+
+namespace po = boost::program_options;
+using bench_clock = std::chrono::steady_clock;
+
+constexpr uint32_t rate = 16000;
+constexpr size_t chunk_samples = 8000;    // 500 ms, as the capture chunk
+constexpr size_t buffer_samples = 80000;  // 5 s, as the default buffer
+constexpr size_t keep_samples = 1600;
+
+/* per sample decode used by Transcriber::save_files before Converter */
+static void legacy_convert(const uint8_t *buffer, float *out, size_t frames,
+                           uint8_t channels, size_t sample_size) {
+  size_t bytes_per_frame = sample_size * channels;
+  for (size_t offset = 0; offset < frames; offset++) {
+    float pcmFloat{0};
+    for (uint16_t ch = 0; ch < channels; ch++) {
+      const uint8_t *in = buffer + offset * bytes_per_frame + ch * sample_size;
+      switch (sample_size) {
+      case 2: {
+        int16_t pcm = *in | (*(in + 1) << 8);
+        pcmFloat += static_cast<float>(pcm) / 32768.0f;
+      } break;
+      case 3: {
+        int32_t pcm = *in | (*(in + 1) << 8) | (*(in + 2) << 16);
+        if (*(in + 2) & 0x80) {
+          pcm |= (0xFF << 24);
+        }
+        pcmFloat += static_cast<float>(pcm) / 8388608.0f;
+      } break;
+      case 4: {
+        int32_t pcm =
+            *in | (*(in + 1) << 8) | (*(in + 2) << 16) | (*(in + 3) << 24);
+        pcmFloat += static_cast<float>(pcm) / 2147483648.0f;
+      } break;
+      }
+    }
+    out[offset] = pcmFloat;
+  }
+}
+
+/* run fn until at least min_seconds elapsed, return frames per second */
+template <typename Fn>
+static double frames_per_sec(Fn fn, size_t frames, double min_seconds) {
+  size_t iterations = 0;
+  auto start = bench_clock::now();
+  std::chrono::duration<double> elapsed{0};
+  do {
+    fn();
+    iterations++;
+    elapsed = bench_clock::now() - start;
+  } while (elapsed.count() < min_seconds);
+  return iterations * frames / elapsed.count();
+}
+
+static double elapsed_ms(bench_clock::time_point start) {
+  return std::chrono::duration<double, std::milli>(bench_clock::now() - start)
+      .count();
+}
+
+static long peak_rss_kb() {
+  struct rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+  return usage.ru_maxrss;
+}
+
+static std::string json_string(const std::string &in) {
+  std::ostringstream out;
+  out << '"';
+  for (char c : in) {
+    if (c == '"' || c == '\\') {
+      out << '\\' << c;
+    } else if (static_cast<unsigned char>(c) < 0x20) {
+      out << "\\u" << std::hex << std::setw(4) << std::setfill('0')
+          << static_cast<int>(c) << std::dec;
+    } else {
+      out << c;
+    }
+  }
+  out << '"';
+  return out.str();
+}
+
+static double percentile(std::vector<double> values, double p) {
+  if (values.empty()) {
+    return 0;
+  }
+  std::sort(values.begin(), values.end());
+  size_t index = std::min<size_t>(p / 100 * values.size(), values.size() - 1);
+  return values[index];
+}
+
+static void fill_random(std::vector<uint8_t> &buf, SampleFormat format) {
+  std::mt19937 gen(42);
+  if (format == SampleFormat::FLOAT_LE) {
+    std::uniform_real_distribution<float> dist(-1.0f, 1.0f);
+    for (size_t i = 0; i + 4 <= buf.size(); i += 4) {
+      float v = dist(gen);
+      std::memcpy(buf.data() + i, &v, sizeof(v));
+    }
+  } else {
+    std::uniform_int_distribution<int> dist(0, 255);
+    for (auto &b : buf) {
+      b = dist(gen);
+    }
+  }
+}
+
+static void bench_convert(std::ostream &json, double min_seconds) {
+  const SampleFormat formats[] = {SampleFormat::S16_LE, SampleFormat::S24_3LE,
+                                  SampleFormat::S32_LE,
+                                  SampleFormat::FLOAT_LE};
+  const uint8_t channels_list[] = {1, 2, 6, 8, 16, 32};
+  const size_t frames = chunk_samples;
+
+  json << "  \"convert\": [";
+  const char *sep = "\n";
+  for (auto format : formats) {
+    for (auto channels : channels_list) {
+      Converter converter;
+      if (!converter.init(format, channels)) {
+        std::cerr << "cannot init converter\n";
+        std::exit(EXIT_FAILURE);
+      }
+      size_t sample_size = converter.get_sample_size();
+      std::vector<uint8_t> in(frames * channels * sample_size);
+      fill_random(in, format);
+      std::vector<float> ref(frames), out(frames);
+
+      double legacy_fps = 0;
+      if (format != SampleFormat::FLOAT_LE) {
+        legacy_fps = frames_per_sec(
+            [&] {
+              legacy_convert(in.data(), ref.data(), frames, channels,
+                             sample_size);
+            },
+            frames, min_seconds);
+      } else {
+        for (size_t f = 0; f < frames; f++) {
+          const float *p = reinterpret_cast<const float *>(in.data()) +
+                           f * channels;
+          ref[f] = 0;
+          for (size_t c = 0; c < channels; c++)
+            ref[f] += p[c];
+        }
+      }
+      double kernel_fps = frames_per_sec(
+          [&] { converter.convert(in.data(), out.data(), frames); }, frames,
+          min_seconds);
+
+      float max_err{0};
+      for (size_t f = 0; f < frames; f++) {
+        max_err = std::max(max_err, std::fabs(out[f] - ref[f]));
+      }
+
+      /* one plane per channel */
+      double planar_fps = 0;
+      if (channels > 1) {
+        std::vector<uint8_t> groups(channels);
+        for (size_t c = 0; c < channels; c++) {
+          groups[c] = c;
+        }
+        Converter planar;
+        planar.init(format, channels, groups);
+        std::vector<float> planes(frames * channels);
+        std::vector<float *> outs(channels);
+        for (size_t c = 0; c < channels; c++) {
+          outs[c] = planes.data() + c * frames;
+        }
+        planar_fps = frames_per_sec(
+            [&] { planar.convert(in.data(), outs.data(), frames); }, frames,
+            min_seconds);
+      }
+
+      json << sep << "    {\"format\": "
+           << json_string(Converter::format_name(format))
+           << ", \"channels\": " << static_cast<int>(channels)
+           << ", \"kernel\": " << json_string(converter.get_name())
+           << std::fixed << std::setprecision(0)
+           << ", \"legacy_frames_per_sec\": " << legacy_fps
+           << ", \"frames_per_sec\": " << kernel_fps
+           << ", \"planar_frames_per_sec\": " << planar_fps
+           << std::setprecision(2) << ", \"speedup\": "
+           << (legacy_fps > 0 ? kernel_fps / legacy_fps : 0)
+           << std::scientific << std::setprecision(1)
+           << ", \"max_error\": " << max_err << std::defaultfloat << "}";
+      sep = ",\n";
+    }
+  }
+  json << "\n  ],\n";
+}
+
+/* mono float input through the resampler block by block */
+static std::vector<float> resample(Resampler &resampler,
+                                   const std::vector<float> &in,
+                                   uint32_t in_rate) {
+  std::vector<float> out(in.size() * rate / in_rate + Resampler::block_frames);
+  size_t produced{0};
+  for (size_t f = 0; f < in.size(); f += Resampler::block_frames) {
+    size_t n = std::min(Resampler::block_frames, in.size() - f);
+    std::memcpy(resampler.get_input()[0], in.data() + f, n * sizeof(float));
+    float *o = out.data() + produced;
+    produced += resampler.process(n, &o, out.size() - produced);
+  }
+  out.resize(produced);
+  return out;
+}
+
+/* chunks of any length come out exact from the input frames asked for,
+   as the capture fills planes ending with the chunk */
+static bool exact_chunks(Resampler &resampler, uint32_t in_rate) {
+  std::mt19937 gen(7);
+  std::uniform_int_distribution<size_t> lengths(1, 4000);
+  std::vector<float> out(4000);
+  resampler.reset();
+  for (int i = 0; i < 1000; i++) {
+    size_t want = lengths(gen);
+    size_t in = resampler.get_input_frames(want);
+    size_t got{0};
+    do {
+      size_t n = std::min(Resampler::block_frames, in);
+      std::fill_n(resampler.get_input()[0], n, 0.1f);
+      float *o = out.data() + got;
+      got += resampler.process(n, &o, want - got);
+      in -= n;
+    } while (in > 0);
+    if (got != want) {
+      std::cerr << "resample " << in_rate << " to " << rate << ": want "
+                << want << " got " << got << '\n';
+      return false;
+    }
+  }
+  return true;
+}
+
+static void bench_resample(std::ostream &json, double min_seconds) {
+  const uint32_t in_rates[] = {48000, 44100, 32000, 22050, 11025, 8000};
+  const uint8_t channels = 2;
+  /* against the reference sine, a broken filter fails the run */
+  const double min_snr_db = 80;
+  const double max_stopband_db = -80;
+
+  json << "  \"resample\": [";
+  const char *sep = "\n";
+  for (auto in_rate : in_rates) {
+    Resampler resampler;
+    if (!resampler.init(in_rate, rate, 1)) {
+      std::cerr << "cannot init resampler\n";
+      std::exit(EXIT_FAILURE);
+    }
+
+    /* reference: a 1 kHz sine must come out as the same sine delayed by
+       half the filter, a 12 kHz one (above 8 kHz) must be rejected */
+    auto tone = [&](double freq) {
+      std::vector<float> in(in_rate);
+      for (size_t i = 0; i < in.size(); i++) {
+        in[i] = 0.5 * std::sin(2 * M_PI * freq * i / in_rate);
+      }
+      resampler.reset();
+      return resample(resampler, in, in_rate);
+    };
+    double delay = resampler.get_taps() / 2.0 / in_rate;
+    auto pass = tone(1000);
+    double err{0}, sig{0};
+    for (size_t k = rate / 10; k < pass.size(); k++) {
+      double ref = 0.5 * std::sin(2 * M_PI * 1000 * (k / double(rate) - delay));
+      err += (pass[k] - ref) * (pass[k] - ref);
+      sig += ref * ref;
+    }
+    /* upsampling has no input above 8 kHz to reject */
+    double leak{0};
+    if (in_rate > rate) {
+      auto stop = tone(12000);
+      for (size_t k = rate / 10; k < stop.size(); k++) {
+        leak += stop[k] * stop[k];
+      }
+    }
+    double snr_db = 10 * std::log10(sig / err);
+    double stopband_db = in_rate > rate ? 10 * std::log10(leak / sig) : 0;
+    if (snr_db < min_snr_db ||
+        (in_rate > rate && stopband_db > max_stopband_db)) {
+      std::cerr << "resample " << in_rate << " to " << rate << ": snr "
+                << snr_db << " dB stop band " << stopband_db << " dB\n";
+      std::exit(EXIT_FAILURE);
+    }
+    if (!exact_chunks(resampler, in_rate)) {
+      std::exit(EXIT_FAILURE);
+    }
+
+    /* S16 stereo capture chunks converted and resampled in one pass, as
+       Capture::convert does */
+    Converter converter;
+    converter.init(SampleFormat::S16_LE, channels);
+    size_t frames = chunk_samples * in_rate / rate;
+    std::vector<uint8_t> pcm(frames * channels * 2);
+    fill_random(pcm, SampleFormat::S16_LE);
+    std::vector<float> out(chunk_samples + Resampler::block_frames);
+    double fused_fps = frames_per_sec(
+        [&] {
+          float *o = out.data();
+          for (size_t f = 0; f < frames; f += Resampler::block_frames) {
+            size_t n = std::min(Resampler::block_frames, frames - f);
+            converter.convert(pcm.data() + f * channels * 2,
+                              resampler.get_input()[0], n);
+            o += resampler.process(n, &o, out.data() + out.size() - o);
+          }
+        },
+        frames, min_seconds);
+
+    json << sep << "    {\"in_rate\": " << in_rate << ", \"out_rate\": " << rate
+         << ", \"kernel\": " << json_string(resampler.get_name())
+         << ", \"phases\": " << resampler.get_phases()
+         << ", \"taps\": " << resampler.get_taps() << std::fixed
+         << std::setprecision(0) << ", \"frames_per_sec\": " << fused_fps
+         << std::setprecision(1)
+         << ", \"snr_db\": " << snr_db << ", \"stopband_db\": ";
+    if (in_rate > rate) {
+      json << stopband_db;
+    } else {
+      json << "null";
+    }
+    json << std::defaultfloat << ", \"exact_chunks\": true}";
+    sep = ",\n";
+  }
+  json << "\n  ],\n";
+}
+
+/* speech like bursts: 1.5 s of a modulated harmonic tone, 0.5 s pause */
+static std::vector<float> synthetic_audio(double seconds) {
+  std::vector<float> audio(seconds * rate);
+  std::mt19937 gen(42);
+  std::normal_distribution<float> noise(0, 2e-4);
+  for (size_t i = 0; i < audio.size(); i++) {
+    double t = static_cast<double>(i) / rate;
+    float sample = noise(gen);
+    if (std::fmod(t, 2.0) < 1.5) {
+      double pitch = 120 + 30 * std::sin(2 * M_PI * 0.7 * t);
+      double envelope = 0.5 + 0.5 * std::sin(2 * M_PI * 4 * t);
+      for (int h = 1; h <= 5; h++) {
+        sample += 0.05 / h * envelope * std::sin(2 * M_PI * pitch * h * t);
+      }
+    }
+    audio[i] = sample;
+  }
+  return audio;
+}
+
+/* decode a WAV or raw file through the file capture backend */
+static bool load_audio(const std::string &path, std::vector<float> &audio) {
+  auto capture = Capture::create("file:" + path, false);
+  if (!capture->open("file:" + path, rate, 1)) {
+    return false;
+  }
+  capture->set_chunk_samples(chunk_samples);
+  std::vector<float> chunk(chunk_samples);
+  while (capture->read(chunk.data()) > 0) {
+    audio.insert(audio.end(), chunk.begin(), chunk.end());
+  }
+  return capture->is_eof();
+}
+
+struct Segment {
+  size_t offset;
+  size_t samples;
+};
+
+/* cut the audio as the capture thread does and keep the speech */
+static std::vector<Segment> split(const std::vector<float> &audio,
+                                  Segmenter &segmenter) {
+  std::vector<Segment> segments;
+  size_t start = 0;
+  size_t pos = 0;
+  segmenter.reset();
+  while (pos < audio.size()) {
+    size_t n = std::min(chunk_samples, audio.size() - pos);
+    bool pause = segmenter.process(audio.data() + pos, n);
+    pos += n;
+    size_t length = pos - start;
+    size_t cut = 0;
+    if (pause) {
+      cut = segmenter.get_cut();
+    } else if (length + chunk_samples > buffer_samples) {
+      cut = segmenter.get_quietest();
+    } else if (pos == audio.size()) {
+      cut = length;
+    } else if (!segmenter.has_speech() &&
+               length > segmenter.get_pad_samples()) {
+      size_t drop = length - segmenter.get_pad_samples();
+      segmenter.discard(drop);
+      start += drop;
+    }
+    if (cut) {
+      size_t begin = segmenter.get_begin();
+      size_t end = std::min(segmenter.get_end(), cut);
+      if (segmenter.has_speech() && end > begin + keep_samples) {
+        segments.push_back({start + begin, end - begin});
+      }
+      /* the tail past the cut is analyzed again with the next segment */
+      start += cut;
+      pos = start;
+      segmenter.reset();
+    }
+  }
+  return segments;
+}
+
+static std::vector<Segment> bench_segmenter(std::ostream &json,
+                                            const std::vector<float> &audio,
+                                            double min_seconds) {
+  Segmenter segmenter;
+  segmenter.init(rate, 1e-3, rate, rate * 300 / 1000);
+  std::vector<Segment> segments;
+  double fps = frames_per_sec([&] { segments = split(audio, segmenter); },
+                              audio.size(), min_seconds);
+  size_t speech{0};
+  for (const auto &segment : segments) {
+    speech += segment.samples;
+  }
+  json << "  \"segmenter\": {\"frames_per_sec\": " << std::fixed
+       << std::setprecision(0) << fps << ", \"segments\": " << segments.size()
+       << std::setprecision(3) << ", \"audio_s\": "
+       << static_cast<double>(audio.size()) / rate << ", \"speech_s\": "
+       << static_cast<double>(speech) / rate << std::defaultfloat << "},\n";
+  return segments;
+}
+
+static bool bench_inference(std::ostream &json, const Config &config,
+                            const std::vector<float> &audio,
+                            const std::vector<Segment> &segments,
+                            const std::vector<int> &threads_list,
+                            int workers, const char *&sep) {
+  Model model(config);
+  auto start = bench_clock::now();
+  if (!model.init()) {
+    std::cerr << "cannot load model " << config.get_model() << '\n';
+    return false;
+  }
+  double load_ms = elapsed_ms(start);
+
+  for (int threads : threads_list) {
+    Scheduler scheduler;
+    if (!scheduler.init(model, workers, threads, false)) {
+      return false;
+    }
+    size_t queue = scheduler.add_queue();
+    /* no sinks, the text is not part of the measure */
+    Output output;
+    Whisper whisper(config, model, output);
+    whisper.init();
+
+    /* one buffer at a time: latency from buffer close to text emitted */
+    std::vector<double> latency;
+    size_t tokens{0};
+    start = bench_clock::now();
+    for (const auto &segment : segments) {
+      auto result = std::make_shared<Whisper::Result>();
+      auto closed = bench_clock::now();
+      scheduler.submit(
+          queue, 0,
+          [&whisper, &audio, segment, result](Worker &worker) {
+            whisper.transribe(worker, audio.data() + segment.offset,
+                              segment.samples, *result);
+          },
+          [&, segment, result, closed]() {
+            whisper.process_result(*result, segment.offset * 100 / rate);
+            latency.push_back(elapsed_ms(closed));
+            for (const auto &s : *result) {
+              tokens += s.tokens.size();
+            }
+          });
+      scheduler.drain(queue);
+    }
+    double total_ms = elapsed_ms(start);
+    double audio_ms = 1000.0 * audio.size() / rate;
+
+    /* all the buffers queued at once on the worker pool */
+    double pool_ms = 0;
+    if (workers > 1) {
+      start = bench_clock::now();
+      for (size_t i = 0; i < segments.size(); i++) {
+        const auto segment = segments[i];
+        auto result = std::make_shared<Whisper::Result>();
+        scheduler.submit(
+            queue, i,
+            [&whisper, &audio, segment, result](Worker &worker) {
+              whisper.transribe(worker, audio.data() + segment.offset,
+                                segment.samples, *result);
+            },
+            nullptr);
+      }
+      scheduler.drain(queue);
+      pool_ms = elapsed_ms(start);
+    }
+    scheduler.terminate();
+
+    json << sep << "    {\"model\": " << json_string(config.get_model())
+         << ", \"workers\": " << workers << ", \"threads\": " << threads
+         << std::fixed << std::setprecision(1) << ", \"load_ms\": " << load_ms
+         << ", \"buffers\": " << segments.size() << ", \"tokens\": "
+         << tokens << std::setprecision(4) << ", \"rtf\": "
+         << total_ms / audio_ms << ", \"rtf_pool\": " << pool_ms / audio_ms
+         << std::setprecision(1) << ", \"latency_ms\": {\"p50\": "
+         << percentile(latency, 50) << ", \"p95\": "
+         << percentile(latency, 95) << ", \"p99\": "
+         << percentile(latency, 99) << "}, \"peak_rss_kb\": "
+         << peak_rss_kb() << std::defaultfloat << "}";
+    sep = ",\n";
+  }
+  return true;
+}
+
+int main(int argc, char *argv[]) {
+  po::options_description desc("Options");
+  desc.add_options()
+      ("min_seconds", po::value<double>()->default_value(0.2, "0.2"), "Minimum duration of each throughput measurement")
+      ("model,m", po::value<std::vector<std::string>>()->composing(), "Whisper model to benchmark, repeat for more models")
+      ("threads", po::value<std::vector<int>>()->multitoken(), "Whisper threads per worker to benchmark")
+      ("workers", po::value<int>()->default_value(1), "Whisper inference workers")
+      ("audio", po::value<std::string>(), "Reference WAV or raw PCM file, synthetic audio if not set")
+      ("duration", po::value<double>()->default_value(30), "Synthetic audio duration in seconds")
+      ("language,l", po::value<std::string>()->default_value("en"), "Whisper language")
+      ("log_level,d", po::value<int>()->default_value(4), "Log level from 0=trace to 5=fatal")
+      ("help,h", "Print this help message");
+
+  po::variables_map vm;
+  try {
+    po::store(po::parse_command_line(argc, argv, desc), vm);
+    po::notify(vm);
+    if (vm.count("help")) {
+      std::cout << "USAGE: " << argv[0] << '\n' << desc << '\n';
+      return EXIT_SUCCESS;
+    }
+  } catch (po::error &poe) {
+    std::cerr << poe.what() << '\n'
+              << "USAGE: " << argv[0] << '\n'
+              << desc << '\n';
+    return EXIT_FAILURE;
+  }
+
+  Config config;
+  config.set_log_severity(vm["log_level"].as<int>());
+  config.set_language(vm["language"].as<std::string>());
+  log_init(config);
+
+  double min_seconds = vm["min_seconds"].as<double>();
+  std::vector<float> audio;
+  if (vm.count("audio")) {
+    if (!load_audio(vm["audio"].as<std::string>(), audio)) {
+      std::cerr << "cannot read audio " << vm["audio"].as<std::string>()
+                << '\n';
+      return EXIT_FAILURE;
+    }
+  } else {
+    audio = synthetic_audio(vm["duration"].as<double>());
+  }
+
+  std::ostringstream json;
+  json << "{\n";
+  bench_convert(json, min_seconds);
+  bench_resample(json, min_seconds);
+  auto segments = bench_segmenter(json, audio, min_seconds);
+
+  std::vector<int> threads_list{4};
+  if (vm.count("threads")) {
+    threads_list = vm["threads"].as<std::vector<int>>();
+  }
+  json << "  \"inference\": [";
+  const char *sep = "\n";
+  if (vm.count("model")) {
+    for (const auto &model : vm["model"].as<std::vector<std::string>>()) {
+      config.set_model(model);
+      if (!bench_inference(json, config, audio, segments, threads_list,
+                           vm["workers"].as<int>(), sep)) {
+        return EXIT_FAILURE;
+      }
+    }
+  }
+  json << (*sep == ',' ? "\n  ],\n" : "],\n");
+  json << "  \"peak_rss_kb\": " << peak_rss_kb() << "\n}\n";
+  std::cout << json.str();
+  return EXIT_SUCCESS;
+}
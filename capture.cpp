@@ -11,8 +11,12 @@
 //  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
 //
 
+#include <algorithm>
+
 #include "capture.hpp"
+#include "file_capture.hpp"
 #include "log.hpp"
+#include "metrics.hpp"
 #include "utils.hpp"
 #include <sys/time.h>
 
@@ -28,7 +32,26 @@
   } while (0)
 #endif
 
-bool Capture::xrun() {
+static bool to_sample_format(snd_pcm_format_t format, SampleFormat &out) {
+  switch (format) {
+  case SND_PCM_FORMAT_S16_LE:
+    out = SampleFormat::S16_LE;
+    return true;
+  case SND_PCM_FORMAT_S24_3LE:
+    out = SampleFormat::S24_3LE;
+    return true;
+  case SND_PCM_FORMAT_S32_LE:
+    out = SampleFormat::S32_LE;
+    return true;
+  case SND_PCM_FORMAT_FLOAT_LE:
+    out = SampleFormat::FLOAT_LE;
+    return true;
+  default:
+    return false;
+  }
+}
+
+bool AlsaCapture::xrun() {
   snd_pcm_status_t *status;
   int res;
   snd_pcm_status_alloca(&status);
@@ -45,6 +68,11 @@ bool Capture::xrun() {
     BOOST_LOG_TRIVIAL(error)
         << "capture:: pcm_xrun overrun!!! (at least "
         << diff.tv_sec * 1000 + diff.tv_usec / 1000.0 << " ms long";
+    xruns_->add();
+    /* frames of the device, before resampling */
+    xrun_frames_->add(static_cast<uint64_t>(diff.tv_sec) * device_rate_ +
+                      static_cast<uint64_t>(diff.tv_usec) * device_rate_ /
+                          1000000);
 
     if ((res = snd_pcm_prepare(capture_handle_)) < 0) {
       BOOST_LOG_TRIVIAL(error)
@@ -70,9 +98,10 @@ bool Capture::xrun() {
 }
 
 /* I/O suspend handler */
-bool Capture::suspend() {
+bool AlsaCapture::suspend() {
   int res;
   BOOST_LOG_TRIVIAL(info) << "capture:: Suspended. Trying resume. ";
+  suspends_->add();
   while ((res = snd_pcm_resume(capture_handle_)) == -EAGAIN)
     sleep(1); /* wait until suspend flag is released */
   if (res < 0) {
@@ -86,39 +115,280 @@ bool Capture::suspend() {
   return true;
 }
 
-ssize_t Capture::read(uint8_t *data) {
-  ssize_t r;
-  size_t count = chunk_samples_;
+bool AlsaCapture::recover(int err) {
+  if (err == -EPIPE) {
+    return xrun();
+  }
+  if (err == -ESTRPIPE) {
+    return suspend();
+  }
+  BOOST_LOG_TRIVIAL(error) << "capture:: read error: " << snd_strerror(err);
+  return false;
+}
 
+std::unique_ptr<Capture> Capture::create(const std::string &device,
+                                         bool paced) {
+  if (device == "stdin" || device.rfind("file:", 0) == 0) {
+    return std::make_unique<FileCapture>(paced);
+  }
+  return std::make_unique<AlsaCapture>();
+}
+
+ssize_t Capture::read(float *const *out) {
   if (!is_open_) {
     return -1;
   }
+  begin_read(out);
+  return read_chunk();
+}
 
-  while (count > 0) {
-    r = snd_pcm_readi(capture_handle_, data, count);
-    if (r == -EAGAIN || (r >= 0 && (size_t)r < count)) {
-      if (!is_open_)
+void Capture::begin_read(float *const *out) {
+  std::copy(out, out + planes_.size(), planes_.begin());
+  remaining_ = chunk_samples_;
+}
+
+bool Capture::init_converter(SampleFormat format, uint8_t channels,
+                             const std::vector<uint8_t> &groups) {
+  if (!converter_.init(format, channels, groups)) {
+    return false;
+  }
+  format_ = format;
+  planes_.assign(converter_.get_groups_num(), nullptr);
+  BOOST_LOG_TRIVIAL(info) << "capture:: using " << converter_.get_name()
+                          << " conversion for "
+                          << Converter::format_name(format) << " "
+                          << (int)channels << " channels to "
+                          << planes_.size() << " planes";
+  return true;
+}
+
+bool Capture::init_resampler(uint32_t rate) {
+  rate_ = rate;
+  if (!resampler_.init(device_rate_, rate_, planes_.size())) {
+    BOOST_LOG_TRIVIAL(fatal) << "capture:: cannot resample " << device_rate_
+                             << " to " << rate_;
+    return false;
+  }
+  if (resampler_.is_enabled()) {
+    BOOST_LOG_TRIVIAL(info)
+        << "capture:: resampling " << device_rate_ << " to " << rate_
+        << " with " << resampler_.get_name() << " polyphase filter, "
+        << resampler_.get_phases() << " phases " << resampler_.get_taps()
+        << " taps";
+  }
+  return true;
+}
+
+snd_pcm_uframes_t Capture::convert(const uint8_t *in,
+                                   snd_pcm_uframes_t frames) {
+  TraceSpan span("convert");
+  snd_pcm_uframes_t produced{0};
+  if (!resampler_.is_enabled()) {
+    converter_.convert(in, planes_.data(), frames);
+    produced = frames;
+  } else {
+    /* convert a block at a time into the resampler and filter it while
+       still in cache */
+    size_t bytes_per_frame =
+        converter_.get_sample_size() * converter_.get_channels();
+    /* windows left over by the previous chunk are produced even
+       without input */
+    do {
+      size_t n = std::min<size_t>(frames, Resampler::block_frames);
+      if (n) {
+        converter_.convert(in, resampler_.get_input(), n);
+      }
+      /* never past the chunk, the output planes end there */
+      size_t out = resampler_.process(
+          n, planes_.data(), remaining_ - std::min(produced, remaining_));
+      for (auto &plane : planes_) {
+        plane += out;
+      }
+      produced += out;
+      in += n * bytes_per_frame;
+      frames -= n;
+    } while (frames > 0);
+    return produced;
+  }
+  for (auto &plane : planes_) {
+    plane += produced;
+  }
+  return produced;
+}
+
+ssize_t AlsaCapture::read_chunk() {
+  return mmap_ ? read_mmap(true) : read_rw(true);
+}
+
+bool AlsaCapture::get_poll_fds(std::vector<pollfd> &fds) {
+  int count = snd_pcm_poll_descriptors_count(capture_handle_);
+  if (count <= 0) {
+    return false;
+  }
+  fds.resize(count);
+  int err = snd_pcm_poll_descriptors(capture_handle_, fds.data(), count);
+  if (err < 0) {
+    BOOST_LOG_TRIVIAL(error)
+        << "capture:: cannot get poll descriptors: " << snd_strerror(err);
+    return false;
+  }
+  fds.resize(err);
+  return !fds.empty();
+}
+
+ssize_t AlsaCapture::poll_read(pollfd *fds, size_t fds_num) {
+  if (!is_open_) {
+    return -1;
+  }
+  unsigned short revents{0};
+  int err = snd_pcm_poll_descriptors_revents(capture_handle_, fds, fds_num,
+                                             &revents);
+  if (err < 0) {
+    BOOST_LOG_TRIVIAL(error)
+        << "capture:: cannot get poll events: " << snd_strerror(err);
+    return -1;
+  }
+  if (revents & POLLERR) {
+    /* recover as the blocking read would on the read error */
+    switch (snd_pcm_state(capture_handle_)) {
+    case SND_PCM_STATE_XRUN:
+      if (!recover(-EPIPE))
         return -1;
-      snd_pcm_wait(capture_handle_, 1000);
-    } else if (r == -EPIPE) {
-      if (!xrun())
+      break;
+    case SND_PCM_STATE_SUSPENDED:
+      if (!recover(-ESTRPIPE))
         return -1;
-    } else if (r == -ESTRPIPE) {
-      if (!suspend())
+      break;
+    default:
+      break;
+    }
+  }
+  /* the read also starts a prepared stream, which doesn't poll ready */
+  return mmap_ ? read_mmap(false) : read_rw(false);
+}
+
+ssize_t AlsaCapture::read_rw(bool block) {
+  snd_pcm_sframes_t r;
+
+  while (remaining_ > 0) {
+    snd_pcm_uframes_t frames = input_frames(remaining_);
+    if (frames == 0) {
+      /* the resampler has the windows left over by the last chunk */
+      remaining_ -= std::min(convert(nullptr, 0), remaining_);
+      continue;
+    }
+    r = snd_pcm_readi(capture_handle_, buffer_.get(), frames);
+    if (r > 0) {
+      remaining_ -= std::min(convert(buffer_.get(), r), remaining_);
+    }
+    if (r == -EAGAIN || (r >= 0 && (size_t)r < frames)) {
+      if (!is_open_)
         return -1;
+      if (!block)
+        return 0;
+      snd_pcm_wait(capture_handle_, 1000);
     } else if (r < 0) {
-      BOOST_LOG_TRIVIAL(error) << "capture:: read error: " << snd_strerror(r);
+      if (!recover(r))
+        return -1;
+    }
+  }
+  return chunk_samples_;
+}
+
+ssize_t AlsaCapture::read_mmap(bool block) {
+  while (remaining_ > 0) {
+    if (!is_open_)
       return -1;
+    if (input_frames(remaining_) == 0) {
+      /* the resampler has the windows left over by the last chunk */
+      remaining_ -= std::min(convert(nullptr, 0), remaining_);
+      continue;
     }
-    if (r > 0) {
-      count -= r;
-      data += r * bytes_per_frame_;
+
+    snd_pcm_sframes_t avail = snd_pcm_avail_update(capture_handle_);
+    if (avail < 0) {
+      if (!recover(avail))
+        return -1;
+      continue;
     }
+    if (avail == 0) {
+      /* capture doesn't start on its own with mmap access */
+      if (snd_pcm_state(capture_handle_) == SND_PCM_STATE_PREPARED) {
+        int err = snd_pcm_start(capture_handle_);
+        if (err < 0 && !recover(err))
+          return -1;
+      }
+      if (!block)
+        return 0;
+      int err = snd_pcm_wait(capture_handle_, 1000);
+      if (err < 0 && !recover(err))
+        return -1;
+      continue;
+    }
+
+    const snd_pcm_channel_area_t *areas;
+    snd_pcm_uframes_t offset;
+    snd_pcm_uframes_t frames =
+        std::min<snd_pcm_uframes_t>(input_frames(remaining_), avail);
+    int err = snd_pcm_mmap_begin(capture_handle_, &areas, &offset, &frames);
+    if (err < 0) {
+      if (!recover(err))
+        return -1;
+      continue;
+    }
+
+    /* convert straight from the interleaved DMA area */
+    const uint8_t *in = static_cast<const uint8_t *>(areas[0].addr) +
+                        (areas[0].first + offset * areas[0].step) / 8;
+    snd_pcm_uframes_t produced = convert(in, frames);
+
+    snd_pcm_sframes_t committed =
+        snd_pcm_mmap_commit(capture_handle_, offset, frames);
+    if (committed < 0 || (snd_pcm_uframes_t)committed != frames) {
+      if (!recover(committed < 0 ? committed : -EPIPE))
+        return -1;
+    }
+    remaining_ -= std::min(produced, remaining_);
   }
   return chunk_samples_;
 }
 
-bool Capture::open(const std::string &device, uint32_t rate, uint8_t channels) {
+void AlsaCapture::set_chunk_samples(snd_pcm_uframes_t chunk_samples) {
+  chunk_samples_ = chunk_samples;
+  if (!mmap_) {
+    buffer_.reset(
+        new uint8_t[max_input_frames(chunk_samples_) * bytes_per_frame_]);
+  }
+  if (auto_tune_) {
+    set_avail_min(max_input_frames(chunk_samples_));
+  }
+}
+
+void AlsaCapture::set_avail_min(snd_pcm_uframes_t frames) {
+  /* keep a period of headroom so that a late wake up doesn't overrun */
+  if (buffer_size_ > period_size_) {
+    frames = std::min(frames, buffer_size_ - period_size_);
+  }
+  snd_pcm_sw_params_t *sw_params;
+  snd_pcm_sw_params_alloca(&sw_params);
+  int err;
+  if ((err = snd_pcm_sw_params_current(capture_handle_, sw_params)) < 0 ||
+      (err = snd_pcm_sw_params_set_avail_min(capture_handle_, sw_params,
+                                             frames)) < 0 ||
+      (err = snd_pcm_sw_params(capture_handle_, sw_params)) < 0) {
+    BOOST_LOG_TRIVIAL(warning)
+        << "capture:: cannot set avail_min: " << snd_strerror(err);
+    return;
+  }
+  BOOST_LOG_TRIVIAL(info) << "capture:: wake up every " << frames
+                          << " frames ("
+                          << (frames + period_size_ - 1) / period_size_
+                          << " periods)";
+}
+
+bool AlsaCapture::open(const std::string &device, uint32_t rate,
+                       uint8_t channels, const std::vector<uint8_t> &groups,
+                       bool mmap) {
   if (is_open_) {
     BOOST_LOG_TRIVIAL(error) << "capture:: audio device already open";
     return false;
@@ -146,32 +416,44 @@ bool Capture::open(const std::string &device, uint32_t rate, uint8_t channels) {
     goto fail;
   }
 
-  if ((err = snd_pcm_hw_params_set_access(capture_handle_, hw_params,
-                                          SND_PCM_ACCESS_RW_INTERLEAVED)) < 0) {
+  mmap_ = mmap && snd_pcm_hw_params_test_access(
+                      capture_handle_, hw_params,
+                      SND_PCM_ACCESS_MMAP_INTERLEAVED) == 0;
+  if (mmap && !mmap_) {
+    BOOST_LOG_TRIVIAL(warning)
+        << "capture:: mmap access not supported, falling back to read";
+  }
+  if ((err = snd_pcm_hw_params_set_access(
+           capture_handle_, hw_params,
+           mmap_ ? SND_PCM_ACCESS_MMAP_INTERLEAVED
+                 : SND_PCM_ACCESS_RW_INTERLEAVED)) < 0) {
     BOOST_LOG_TRIVIAL(fatal)
         << "capture:: cannot set access type: " << snd_strerror(err);
     goto fail;
   }
 
-  if ((err = snd_pcm_hw_params_set_format(capture_handle_, hw_params, format)) <
-      0) {
+  if ((err = snd_pcm_hw_params_set_channels(capture_handle_, hw_params,
+                                            channels)) < 0) {
     BOOST_LOG_TRIVIAL(fatal)
-        << "capture:: cannot set sample format: " << snd_strerror(err);
+        << "capture:: cannot set channel count: " << snd_strerror(err);
     goto fail;
   }
 
-  snd_pcm_hw_params_set_rate_resample(capture_handle_, hw_params, 1);
-  if ((err = snd_pcm_hw_params_set_rate_near(capture_handle_, hw_params, &rate,
-                                             0)) < 0) {
-    BOOST_LOG_TRIVIAL(fatal)
-        << "capture:: cannot set sample rate: " << snd_strerror(err);
+  if (!set_format(hw_params) || !set_rate(hw_params, rate) ||
+      !set_buffer(hw_params)) {
     goto fail;
   }
 
-  if ((err = snd_pcm_hw_params_set_channels(capture_handle_, hw_params,
-                                            channels)) < 0) {
-    BOOST_LOG_TRIVIAL(fatal)
-        << "capture:: cannot set channel count: " << snd_strerror(err);
+  {
+    SampleFormat sample_format;
+    if (!to_sample_format(alsa_format_, sample_format) ||
+        !init_converter(sample_format, channels, groups)) {
+      BOOST_LOG_TRIVIAL(fatal) << "capture:: unsupported sample format "
+                               << snd_pcm_format_name(alsa_format_);
+      goto fail;
+    }
+  }
+  if (!init_resampler(rate)) {
     goto fail;
   }
 
@@ -180,13 +462,27 @@ bool Capture::open(const std::string &device, uint32_t rate, uint8_t channels) {
         << "capture:: cannot set parameters: " << snd_strerror(err);
     goto fail;
   }
-  snd_pcm_hw_params_get_period_size(hw_params, &chunk_samples_, 0);
+  snd_pcm_hw_params_get_period_size(hw_params, &period_size_, 0);
   snd_pcm_hw_params_get_periods(hw_params, &periods_, 0);
-  BOOST_LOG_TRIVIAL(debug) << "capture:: period_size " << chunk_samples_
-                           << " periods " << periods_;
-  bytes_per_frame_ = snd_pcm_format_physical_width(format) * channels / 8;
+  snd_pcm_hw_params_get_buffer_size(hw_params, &buffer_size_);
+  BOOST_LOG_TRIVIAL(info) << "capture:: " << device << " period_size "
+                          << period_size_ << " ("
+                          << period_size_ * 1000 / device_rate_
+                          << " ms) periods " << periods_ << " buffer_size "
+                          << buffer_size_ << " ("
+                          << buffer_size_ * 1000 / device_rate_ << " ms)"
+                          << (auto_tune_ ? " auto tuned" : "");
+  /* chunks are counted in output frames */
+  period_samples_ = period_size_ * rate_ / device_rate_;
+  chunk_samples_ = period_samples_;
+  BOOST_LOG_TRIVIAL(info) << "capture:: using "
+                          << (mmap_ ? "mmap" : "read") << " access";
+  bytes_per_frame_ =
+      snd_pcm_format_physical_width(alsa_format_) * channels / 8;
+  set_chunk_samples(chunk_samples_);
 
   snd_pcm_hw_params_free(hw_params);
+  hw_params = 0;
 
   if ((err = snd_pcm_prepare(capture_handle_)) < 0) {
     BOOST_LOG_TRIVIAL(fatal)
@@ -195,6 +491,17 @@ bool Capture::open(const std::string &device, uint32_t rate, uint8_t channels) {
     goto fail;
   }
 
+  {
+    auto &metrics = Metrics::get();
+    auto labels = Metrics::label("device", device);
+    xruns_ = &metrics.counter("whisper_alsa_xruns_total",
+                              "Capture overruns", labels);
+    xrun_frames_ = &metrics.counter("whisper_alsa_xrun_lost_frames_total",
+                                    "Device frames lost in capture overruns", labels);
+    suspends_ = &metrics.counter("whisper_alsa_suspends_total",
+                                 "Capture suspend events", labels);
+  }
+
   is_open_ = true;
   return true;
 
@@ -206,7 +513,120 @@ fail:
   return false;
 }
 
-void Capture::close() {
+bool AlsaCapture::set_format(snd_pcm_hw_params_t *hw_params) {
+  for (auto format : formats) {
+    if (snd_pcm_hw_params_test_format(capture_handle_, hw_params, format) ==
+        0) {
+      int err =
+          snd_pcm_hw_params_set_format(capture_handle_, hw_params, format);
+      if (err < 0) {
+        BOOST_LOG_TRIVIAL(fatal)
+            << "capture:: cannot set sample format: " << snd_strerror(err);
+        return false;
+      }
+      alsa_format_ = format;
+      BOOST_LOG_TRIVIAL(info) << "capture:: sample format "
+                              << snd_pcm_format_name(format);
+      return true;
+    }
+  }
+  BOOST_LOG_TRIVIAL(fatal) << "capture:: no supported sample format";
+  return false;
+}
+
+bool AlsaCapture::set_rate(snd_pcm_hw_params_t *hw_params, uint32_t rate) {
+  /* native rates only, the capture resamples to the output rate */
+  snd_pcm_hw_params_set_rate_resample(capture_handle_, hw_params, 0);
+  unsigned int device_rate = device_rate_ ? device_rate_ : rate;
+  snd_pcm_hw_params_t *probe;
+  snd_pcm_hw_params_alloca(&probe);
+  snd_pcm_hw_params_copy(probe, hw_params);
+  snd_pcm_hw_params_set_rate_near(capture_handle_, probe, &device_rate, 0);
+  if (!Resampler::is_supported(device_rate, rate)) {
+    BOOST_LOG_TRIVIAL(warning) << "capture:: cannot resample device rate "
+                               << device_rate << ", ALSA resampling";
+    snd_pcm_hw_params_set_rate_resample(capture_handle_, hw_params, 1);
+    device_rate = rate;
+  }
+
+  int err = snd_pcm_hw_params_set_rate_near(capture_handle_, hw_params,
+                                            &device_rate, 0);
+  if (err < 0) {
+    BOOST_LOG_TRIVIAL(fatal)
+        << "capture:: cannot set sample rate: " << snd_strerror(err);
+    return false;
+  }
+  device_rate_ = device_rate;
+  BOOST_LOG_TRIVIAL(info) << "capture:: sample rate " << device_rate_;
+  return true;
+}
+
+bool AlsaCapture::set_buffer(snd_pcm_hw_params_t *hw_params) {
+  int err;
+  if (auto_tune_) {
+    snd_pcm_uframes_t buffer_min, buffer_max, period_min, period_max;
+    snd_pcm_hw_params_get_buffer_size_min(hw_params, &buffer_min);
+    snd_pcm_hw_params_get_buffer_size_max(hw_params, &buffer_max);
+    snd_pcm_hw_params_get_period_size_min(hw_params, &period_min, 0);
+    snd_pcm_hw_params_get_period_size_max(hw_params, &period_max, 0);
+    BOOST_LOG_TRIVIAL(info) << "capture:: device buffer_size " << buffer_min
+                            << "-" << buffer_max << " period_size "
+                            << period_min << "-" << period_max;
+
+    /* the largest buffer rides out the longest stalls of the reader, the
+       reader wakes up per chunk so several periods cost no wakeups */
+    snd_pcm_uframes_t buffer_size = std::min<snd_pcm_uframes_t>(
+        buffer_max, device_rate_ * auto_buffer_ms / 1000);
+    if ((err = snd_pcm_hw_params_set_buffer_size_near(
+             capture_handle_, hw_params, &buffer_size)) < 0) {
+      BOOST_LOG_TRIVIAL(fatal)
+          << "capture:: cannot set buffer size: " << snd_strerror(err);
+      return false;
+    }
+    snd_pcm_uframes_t period_size =
+        std::max<snd_pcm_uframes_t>(buffer_size / auto_periods, 1);
+    if ((err = snd_pcm_hw_params_set_period_size_near(
+             capture_handle_, hw_params, &period_size, 0)) < 0) {
+      BOOST_LOG_TRIVIAL(fatal)
+          << "capture:: cannot set period size: " << snd_strerror(err);
+      return false;
+    }
+    return true;
+  }
+
+  if (period_size_req_) {
+    snd_pcm_uframes_t period_size = period_size_req_;
+    if ((err = snd_pcm_hw_params_set_period_size_near(
+             capture_handle_, hw_params, &period_size, 0)) < 0) {
+      BOOST_LOG_TRIVIAL(fatal) << "capture:: cannot set period size "
+                               << period_size_req_ << ": "
+                               << snd_strerror(err);
+      return false;
+    }
+  }
+  if (periods_req_) {
+    unsigned int periods = periods_req_;
+    if ((err = snd_pcm_hw_params_set_periods_near(capture_handle_, hw_params,
+                                                  &periods, 0)) < 0) {
+      BOOST_LOG_TRIVIAL(fatal) << "capture:: cannot set periods "
+                               << periods_req_ << ": " << snd_strerror(err);
+      return false;
+    }
+  }
+  if (buffer_time_ms_req_) {
+    unsigned int buffer_time = buffer_time_ms_req_ * 1000;
+    if ((err = snd_pcm_hw_params_set_buffer_time_near(
+             capture_handle_, hw_params, &buffer_time, 0)) < 0) {
+      BOOST_LOG_TRIVIAL(fatal) << "capture:: cannot set buffer time "
+                               << buffer_time_ms_req_
+                               << " ms: " << snd_strerror(err);
+      return false;
+    }
+  }
+  return true;
+}
+
+void AlsaCapture::close() {
   if (is_open_) {
     snd_pcm_close(capture_handle_);
     is_open_ = false;
@@ -15,37 +15,181 @@
 #define _CAPTURE_HPP_
 
 #include <alsa/asoundlib.h>
+#include <poll.h>
+
 #include <atomic>
 #include <cstdlib>
 #include <iostream>
 #include <memory>
 #include <vector>
 
+#include "convert.hpp"
+#include "metrics.hpp"
+#include "resampler.hpp"
+
+/*
+ * Audio source converting the captured frames to float planes.
+ * AlsaCapture reads from an ALSA capture device, FileCapture replays a
+ * WAV or raw PCM file or stdin.
+ */
 class Capture {
 public:
+  /* source for the device name: file:<path>, stdin or an ALSA device,
+     paced sources are read in real time */
+  static std::unique_ptr<Capture> create(const std::string &device,
+                                         bool paced);
+
   Capture() = default;
   Capture(const Capture &) = delete;
+  virtual ~Capture() = default;
 
-  ssize_t read(uint8_t *data);
-  bool open(const std::string &device, uint32_t rate, uint8_t channels);
-  void close();
+  /* read chunk_samples_ frames converted to mono float */
+  ssize_t read(float *out) { return read(&out); }
+  /* read chunk_samples_ frames converted to one float plane per group,
+     -1 on error or at the end of a replayed source */
+  ssize_t read(float *const *out);
+
+  /* descriptors to poll for an event loop, false if the source can't be
+     polled and needs a reading thread */
+  virtual bool get_poll_fds(std::vector<pollfd> &fds) { return false; }
+  /* start a chunk converted to one float plane per group, the chunk is
+     then read by poll_read() as the frames come */
+  void begin_read(float *const *out);
+  /* handle the events of the get_poll_fds() descriptors and read the
+     available frames without blocking, chunk_samples_ once the chunk is
+     complete, 0 while incomplete, -1 on error */
+  virtual ssize_t poll_read(pollfd *fds, size_t fds_num) { return -1; }
+  /* groups maps each channel to its output plane, empty for downmix */
+  virtual bool open(const std::string &device, uint32_t rate,
+                    uint8_t channels, const std::vector<uint8_t> &groups = {},
+                    bool mmap = true) = 0;
+  virtual void close() = 0;
 
-  uint8_t get_bytes_per_frame() const { return bytes_per_frame_; }
   snd_pcm_uframes_t get_chunk_samples() const { return chunk_samples_; }
-  void set_chunk_samples(snd_pcm_uframes_t chunk_samples) {
+  virtual void set_chunk_samples(snd_pcm_uframes_t chunk_samples) {
     chunk_samples_ = chunk_samples;
   }
-  snd_pcm_format_t get_format() const { return format; }
+  const Converter &get_converter() const { return converter_; }
+  /* format of the source as negotiated by open() */
+  SampleFormat get_format() const { return format_; }
+  /* rate of the converted planes */
+  uint32_t get_rate() const { return rate_; }
+  /* rate of the source, resampled to get_rate() when they differ */
+  uint32_t get_device_rate() const { return device_rate_; }
+  /* rate to open the source at, 0 for the nearest native to the output
+     rate, call before open() */
+  void set_device_rate(uint32_t rate) { device_rate_ = rate; }
+  /* ALSA period size in device frames, periods per buffer and buffer
+     time, 0 for the device default, auto_tune picks the largest safe
+     buffer instead, call before open() */
+  void set_buffer_params(snd_pcm_uframes_t period_size, uint32_t periods,
+                         uint32_t buffer_time_ms, bool auto_tune) {
+    period_size_req_ = period_size;
+    periods_req_ = periods;
+    buffer_time_ms_req_ = buffer_time_ms;
+    auto_tune_ = auto_tune;
+  }
+  /* output frames per hardware period, 0 for sources without periods */
+  snd_pcm_uframes_t get_period_samples() const { return period_samples_; }
+  const Resampler &get_resampler() const { return resampler_; }
+  /* audio is produced in real time and must not be held back */
+  virtual bool is_realtime() const { return true; }
+  /* end of a replayed source reached */
+  bool is_eof() const { return eof_; }
 
-private:
-  constexpr static snd_pcm_format_t format = SND_PCM_FORMAT_S16_LE;
+protected:
+  virtual ssize_t read_chunk() = 0;
+  bool init_converter(SampleFormat format, uint8_t channels,
+                      const std::vector<uint8_t> &groups);
+  /* resampler from the device rate to the output rate */
+  bool init_resampler(uint32_t rate);
+  /* source frames giving exactly frames output frames */
+  snd_pcm_uframes_t input_frames(snd_pcm_uframes_t frames) const {
+    return resampler_.is_enabled() ? resampler_.get_input_frames(frames)
+                                   : frames;
+  }
+  /* upper bound of input_frames() for buffer sizes */
+  snd_pcm_uframes_t max_input_frames(snd_pcm_uframes_t frames) const {
+    return resampler_.is_enabled()
+               ? (frames * device_rate_ + rate_ - 1) / rate_ + 1
+               : frames;
+  }
+  /* convert to the output planes and move past the frames, the number
+     of output frames */
+  snd_pcm_uframes_t convert(const uint8_t *in, snd_pcm_uframes_t frames);
 
+  SampleFormat format_{SampleFormat::S16_LE};
+  uint32_t rate_{0};
+  uint32_t device_rate_{0};
+  Resampler resampler_;
   std::atomic_bool is_open_{false};
-  snd_pcm_t *capture_handle_{0};
+  std::atomic_bool eof_{false};
   snd_pcm_uframes_t chunk_samples_{0};
+  /* output frames left to read in the current chunk */
+  snd_pcm_uframes_t remaining_{0};
+  snd_pcm_uframes_t period_size_req_{0};
+  uint32_t periods_req_{0};
+  uint32_t buffer_time_ms_req_{0};
+  bool auto_tune_{false};
+  snd_pcm_uframes_t period_samples_{0};
+  Converter converter_;
+  /* output planes write position */
+  std::vector<float *> planes_;
+};
+
+class AlsaCapture : public Capture {
+public:
+  AlsaCapture() = default;
+  ~AlsaCapture() override { close(); }
+
+  bool open(const std::string &device, uint32_t rate, uint8_t channels,
+            const std::vector<uint8_t> &groups = {},
+            bool mmap = true) override;
+  void close() override;
+
+  uint8_t get_bytes_per_frame() const { return bytes_per_frame_; }
+  void set_chunk_samples(snd_pcm_uframes_t chunk_samples) override;
+  bool is_mmap() const { return mmap_; }
+  bool get_poll_fds(std::vector<pollfd> &fds) override;
+  ssize_t poll_read(pollfd *fds, size_t fds_num) override;
+  snd_pcm_format_t get_alsa_format() const { return alsa_format_; }
+
+private:
+  /* capture formats by preference, the first one the device supports
+     is used so that no plug layer conversion is needed */
+  constexpr static snd_pcm_format_t formats[] = {
+      SND_PCM_FORMAT_S16_LE, SND_PCM_FORMAT_S32_LE, SND_PCM_FORMAT_S24_3LE,
+      SND_PCM_FORMAT_FLOAT_LE};
+
+  bool set_format(snd_pcm_hw_params_t *hw_params);
+  bool set_rate(snd_pcm_hw_params_t *hw_params, uint32_t rate);
+  bool set_buffer(snd_pcm_hw_params_t *hw_params);
+  /* wake up once the frames of a whole chunk are available */
+  void set_avail_min(snd_pcm_uframes_t frames);
+
+  /* auto tuning keeps up to auto_buffer_ms of audio in auto_periods
+     periods */
+  constexpr static uint32_t auto_buffer_ms = 2000;
+  constexpr static uint32_t auto_periods = 8;
+
+  snd_pcm_t *capture_handle_{0};
+  snd_pcm_uframes_t period_size_{0};
+  snd_pcm_uframes_t buffer_size_{0};
   uint32_t periods_{0};
   size_t bytes_per_frame_{0};
+  bool mmap_{false};
+  snd_pcm_format_t alsa_format_{SND_PCM_FORMAT_S16_LE};
+  Counter *xruns_{nullptr};
+  Counter *xrun_frames_{nullptr};
+  Counter *suspends_{nullptr};
+  /* RW access staging buffer, unused with mmap access */
+  std::unique_ptr<uint8_t[]> buffer_;
 
+  ssize_t read_chunk() override;
+  /* read the rest of the chunk, 0 instead of waiting when not blocking */
+  ssize_t read_rw(bool block);
+  ssize_t read_mmap(bool block);
+  bool recover(int err);
   bool xrun();
   bool suspend();
 };
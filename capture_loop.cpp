@@ -0,0 +1,182 @@
+//
+//  capture_loop.cpp
+//
+//  Copyright (c) 2019 2025 Andrea Bondavalli. All rights reserved.
+//
+//  This program is free software: you can redistribute it and/or modify
+//  it under the terms of the MIT license
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+//
+
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstring>
+
+#include "capture_loop.hpp"
+#include "log.hpp"
+#include "topology.hpp"
+#include "trace.hpp"
+
+bool CaptureLoop::start(const Config &config, const std::string &name) {
+  if (running_) {
+    return true;
+  }
+  name_ = name;
+  epoll_fd_ = epoll_create1(EPOLL_CLOEXEC);
+  event_fd_ = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+  struct epoll_event ev;
+  std::memset(&ev, 0, sizeof(ev));
+  ev.events = EPOLLIN;
+  ev.data.u64 = 0;
+  if (epoll_fd_ < 0 || event_fd_ < 0 ||
+      epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, event_fd_, &ev) < 0) {
+    BOOST_LOG_TRIVIAL(error) << "capture_loop:: cannot create " << name_
+                             << ": " << std::strerror(errno);
+    if (epoll_fd_ >= 0) {
+      ::close(epoll_fd_);
+    }
+    if (event_fd_ >= 0) {
+      ::close(event_fd_);
+    }
+    epoll_fd_ = event_fd_ = -1;
+    return false;
+  }
+
+  running_ = true;
+  thread_ = std::thread([this, config]() {
+    Topology::set_capture_thread(config);
+    Trace::set_thread_name("capture " + name_);
+    loop();
+  });
+  BOOST_LOG_TRIVIAL(info) << "capture_loop:: " << name_ << " started";
+  return true;
+}
+
+void CaptureLoop::stop() {
+  if (!running_) {
+    return;
+  }
+  running_ = false;
+  uint64_t one{1};
+  if (::write(event_fd_, &one, sizeof(one)) < 0) {
+    /* the loop notices within its poll timeout */
+  }
+  thread_.join();
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  for (const auto &[id, source] : sources_) {
+    unwatch(id, source);
+  }
+  sources_.clear();
+  ::close(event_fd_);
+  ::close(epoll_fd_);
+  epoll_fd_ = event_fd_ = -1;
+}
+
+uint64_t CaptureLoop::add(const std::vector<pollfd> &fds, Handler handler) {
+  if (!running_ || fds.empty() || fds.size() >= (1u << fd_bits)) {
+    return 0;
+  }
+  std::lock_guard<std::mutex> lock(mutex_);
+  uint64_t id = next_id_++;
+  Source &source = sources_[id];
+  source.fds = fds;
+  source.handler = std::move(handler);
+  for (size_t i = 0; i < fds.size(); i++) {
+    struct epoll_event ev;
+    std::memset(&ev, 0, sizeof(ev));
+    /* poll and epoll share the event bits */
+    ev.events = static_cast<uint16_t>(fds[i].events);
+    ev.data.u64 = id << fd_bits | i;
+    if (epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, fds[i].fd, &ev) < 0) {
+      BOOST_LOG_TRIVIAL(error) << "capture_loop:: cannot watch fd "
+                               << fds[i].fd << ": " << std::strerror(errno);
+      source.fds.resize(i);
+      unwatch(id, source);
+      sources_.erase(id);
+      return 0;
+    }
+  }
+  BOOST_LOG_TRIVIAL(debug) << "capture_loop:: " << name_ << " source " << id
+                           << " with " << fds.size() << " fds";
+  return id;
+}
+
+void CaptureLoop::remove(uint64_t id) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto it = sources_.find(id);
+  if (it != sources_.end()) {
+    unwatch(id, it->second);
+    sources_.erase(it);
+  }
+}
+
+size_t CaptureLoop::get_sources() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return sources_.size();
+}
+
+void CaptureLoop::unwatch(uint64_t id, const Source &source) {
+  for (const auto &pfd : source.fds) {
+    epoll_ctl(epoll_fd_, EPOLL_CTL_DEL, pfd.fd, nullptr);
+  }
+  BOOST_LOG_TRIVIAL(debug) << "capture_loop:: " << name_ << " source " << id
+                           << " removed";
+}
+
+void CaptureLoop::loop() {
+  BOOST_LOG_TRIVIAL(debug) << "capture_loop:: " << name_ << " loop start";
+  struct epoll_event events[max_events];
+  std::vector<uint64_t> ready;
+  while (running_) {
+    int n = epoll_wait(epoll_fd_, events, max_events, 1000);
+    if (n < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      BOOST_LOG_TRIVIAL(error)
+          << "capture_loop:: epoll error: " << std::strerror(errno);
+      break;
+    }
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    /* gather the events of every source, a PCM may have several fds */
+    ready.clear();
+    for (int i = 0; i < n; i++) {
+      uint64_t id = events[i].data.u64 >> fd_bits;
+      auto it = sources_.find(id);
+      if (it == sources_.end()) {
+        /* wake up or a source removed since the wait */
+        continue;
+      }
+      Source &source = it->second;
+      size_t fd = events[i].data.u64 & ((1u << fd_bits) - 1);
+      source.fds[fd].revents = static_cast<short>(events[i].events);
+      if (!source.ready) {
+        source.ready = true;
+        ready.push_back(id);
+      }
+    }
+
+    for (auto id : ready) {
+      auto it = sources_.find(id);
+      Source &source = it->second;
+      bool keep = source.handler(source.fds.data(), source.fds.size());
+      for (auto &pfd : source.fds) {
+        pfd.revents = 0;
+      }
+      source.ready = false;
+      if (!keep) {
+        unwatch(id, source);
+        sources_.erase(it);
+      }
+    }
+  }
+  BOOST_LOG_TRIVIAL(debug) << "capture_loop:: " << name_ << " loop end";
+}
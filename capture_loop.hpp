@@ -0,0 +1,85 @@
+//
+//  capture_loop.hpp
+//
+//  Copyright (c) 2019 2025 Andrea Bondavalli. All rights reserved.
+//
+//  This program is free software: you can redistribute it and/or modify
+//  it under the terms of the MIT license
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+//
+
+#ifndef _CAPTURE_LOOP_HPP_
+#define _CAPTURE_LOOP_HPP_
+
+#include <poll.h>
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "config.hpp"
+
+/*
+ * Event loop serving many capture devices from a single thread.
+ * Every source registers its poll descriptors, as returned by
+ * snd_pcm_poll_descriptors() for a PCM or a timer or socket fd, and a
+ * handler called on the loop thread with the descriptors and their
+ * events, so that ALSA can translate them with
+ * snd_pcm_poll_descriptors_revents(). Descriptors are level triggered:
+ * a handler reading part of the available frames is called again.
+ */
+class CaptureLoop {
+public:
+  /* false to stop watching the source */
+  using Handler = std::function<bool(pollfd *fds, size_t fds_num)>;
+
+  CaptureLoop() = default;
+  CaptureLoop(const CaptureLoop &) = delete;
+  ~CaptureLoop() { stop(); }
+
+  /* the loop thread is placed as a capture thread */
+  bool start(const Config &config, const std::string &name);
+  void stop();
+
+  /* watch the descriptors, the source id or 0 on error */
+  uint64_t add(const std::vector<pollfd> &fds, Handler handler);
+  /* stop watching, the handler is not running once this returns */
+  void remove(uint64_t id);
+
+  size_t get_sources() const;
+
+private:
+  struct Source {
+    std::vector<pollfd> fds;
+    Handler handler;
+    bool ready{false};
+  };
+
+  /* descriptors per source in the epoll data next to the source id */
+  constexpr static unsigned fd_bits = 8;
+  constexpr static size_t max_events = 64;
+
+  void loop();
+  void unwatch(uint64_t id, const Source &source);
+
+  int epoll_fd_{-1};
+  /* wakes up the loop to stop */
+  int event_fd_{-1};
+  std::string name_;
+  std::atomic_bool running_{false};
+  std::thread thread_;
+  /* held while the handlers run */
+  mutable std::mutex mutex_;
+  std::map<uint64_t, Source> sources_;
+  uint64_t next_id_{1};
+};
+
+#endif
@@ -21,10 +21,13 @@
 class Config {
  public:
   uint8_t get_channels() const { return channels_; }
+  const std::string& get_channel_groups() const { return channel_groups_; }
   uint8_t get_files_num() const { return files_num_; }
   uint16_t get_file_duration() const { return file_duration_; }
   float get_silence_threshold() const { return silence_threshold_; }
   const std::string& get_model() const { return model_; }
+  const std::string& get_draft_model() const { return draft_model_; };
+  uint16_t get_draft_threads() const { return draft_threads_; };
   const std::string& get_language() const { return language_; }
   const std::string& get_openvino_device() const { return openvino_device_; }
   int get_log_severity() const { return log_severity_; };
@@ -33,8 +36,39 @@ class Config {
   bool get_vad_enabled() const { return vad_enabled_; };
   const std::string& get_vad_model() const { return vad_model_; };
   float get_vad_threshold() const { return vad_threshold_; };
+  bool get_use_mmap() const { return use_mmap_; };
+  uint32_t get_period_size() const { return period_size_; };
+  uint32_t get_periods() const { return periods_; };
+  uint32_t get_buffer_time_ms() const { return buffer_time_ms_; };
+  bool get_auto_tune() const { return auto_tune_; };
+  bool get_paced() const { return paced_; };
+  bool get_stream() const { return stream_; };
+  uint16_t get_step_ms() const { return step_ms_; };
+  uint16_t get_window_ms() const { return window_ms_; };
+  uint16_t get_keep_ms() const { return keep_ms_; };
+  uint16_t get_min_segment_ms() const { return min_segment_ms_; };
+  uint16_t get_pause_ms() const { return pause_ms_; };
+  const std::string& get_pipeline_name() const { return pipeline_name_; };
+  const std::string& get_output() const { return output_; };
+  const std::string& get_sinks() const { return sinks_; };
+  uint32_t get_sample_rate() const { return sample_rate_; };
+  uint32_t get_store_segments() const { return store_segments_; };
+  uint32_t get_store_retention_s() const { return store_retention_s_; };
+  uint8_t get_workers() const { return workers_; };
+  uint16_t get_worker_threads() const { return worker_threads_; };
+  float get_max_rtf() const { return max_rtf_; };
+  uint8_t get_capture_threads() const { return capture_threads_; };
+  int16_t get_capture_cpu() const { return capture_cpu_; };
+  uint8_t get_capture_priority() const { return capture_priority_; };
+  const std::string& get_inference_cpus() const { return inference_cpus_; };
+  uint16_t get_metrics_port() const { return metrics_port_; };
+  const std::string& get_trace_file() const { return trace_file_; };
+  const std::string& get_control_socket() const { return control_socket_; };
 
   void set_channels(uint8_t channels) { channels_ = channels; }
+  void set_channel_groups(const std::string& channel_groups) {
+    channel_groups_ = channel_groups;
+  }
   void set_files_num(uint8_t files_num) { files_num_ = files_num; }
   void set_file_duration(uint8_t file_duration) {
     file_duration_ = file_duration;
@@ -43,6 +77,12 @@ class Config {
     silence_threshold_ = silence_threshold;
   }
   void set_model(const std::string& model) { model_ = model; }
+  void set_draft_model(const std::string& draft_model) {
+    draft_model_ = draft_model;
+  };
+  void set_draft_threads(uint16_t draft_threads) {
+    draft_threads_ = draft_threads;
+  };
   void set_language(const std::string& language) { language_ = language; }
   void set_openvino_device(const std::string& openvino_device) {
     openvino_device_ = openvino_device;
@@ -58,14 +98,68 @@ class Config {
   void set_vad_threshold(float vad_threshold) {
     vad_threshold_ = vad_threshold;
   };
+  void set_use_mmap(bool use_mmap) { use_mmap_ = use_mmap; };
+  void set_period_size(uint32_t period_size) { period_size_ = period_size; };
+  void set_periods(uint32_t periods) { periods_ = periods; };
+  void set_buffer_time_ms(uint32_t buffer_time_ms) {
+    buffer_time_ms_ = buffer_time_ms;
+  };
+  void set_auto_tune(bool auto_tune) { auto_tune_ = auto_tune; };
+  void set_paced(bool paced) { paced_ = paced; };
+  void set_stream(bool stream) { stream_ = stream; };
+  void set_step_ms(uint16_t step_ms) { step_ms_ = step_ms; };
+  void set_window_ms(uint16_t window_ms) { window_ms_ = window_ms; };
+  void set_keep_ms(uint16_t keep_ms) { keep_ms_ = keep_ms; };
+  void set_min_segment_ms(uint16_t min_segment_ms) {
+    min_segment_ms_ = min_segment_ms;
+  };
+  void set_pause_ms(uint16_t pause_ms) { pause_ms_ = pause_ms; };
+  void set_pipeline_name(const std::string& pipeline_name) {
+    pipeline_name_ = pipeline_name;
+  };
+  void set_output(const std::string& output) { output_ = output; };
+  void set_sinks(const std::string& sinks) { sinks_ = sinks; };
+  void set_store_segments(uint32_t store_segments) {
+    store_segments_ = store_segments;
+  };
+  void set_store_retention_s(uint32_t store_retention_s) {
+    store_retention_s_ = store_retention_s;
+  };
+  void set_workers(uint8_t workers) { workers_ = workers; };
+  void set_worker_threads(uint16_t worker_threads) {
+    worker_threads_ = worker_threads;
+  };
+  void set_max_rtf(float max_rtf) { max_rtf_ = max_rtf; };
+  void set_capture_threads(uint8_t capture_threads) {
+    capture_threads_ = capture_threads;
+  };
+  void set_capture_cpu(int16_t capture_cpu) { capture_cpu_ = capture_cpu; };
+  void set_capture_priority(uint8_t capture_priority) {
+    capture_priority_ = capture_priority;
+  };
+  void set_inference_cpus(const std::string& inference_cpus) {
+    inference_cpus_ = inference_cpus;
+  };
+  void set_trace_file(const std::string& trace_file) {
+    trace_file_ = trace_file;
+  };
+  void set_control_socket(const std::string& control_socket) {
+    control_socket_ = control_socket;
+  };
+  void set_metrics_port(uint16_t metrics_port) {
+    metrics_port_ = metrics_port;
+  };
 
  private:
   uint8_t channels_{4};
+  std::string channel_groups_;
   uint8_t files_num_{4};
   uint16_t file_duration_{5};
   uint32_t sample_rate_{16000};
   float silence_threshold_{1e-3};
   std::string model_{"./models/ggml-base.en.bin"};
+  std::string draft_model_;
+  uint16_t draft_threads_{2};
   std::string language_{"en"};
   std::string openvino_device_{"CPU"};
   int log_severity_{2};
@@ -74,6 +168,33 @@ class Config {
   bool vad_enabled_{false};
   std::string vad_model_{"./models/ggml-silero-v5.1.2.bin"};
   float vad_threshold_{1e-1};
+  bool use_mmap_{true};
+  uint32_t period_size_{0};
+  uint32_t periods_{0};
+  uint32_t buffer_time_ms_{0};
+  bool auto_tune_{false};
+  bool paced_{true};
+  bool stream_{false};
+  uint16_t step_ms_{500};
+  uint16_t window_ms_{5000};
+  uint16_t keep_ms_{200};
+  uint16_t min_segment_ms_{1000};
+  uint16_t pause_ms_{300};
+  std::string pipeline_name_;
+  std::string output_;
+  std::string sinks_;
+  uint32_t store_segments_{1024};
+  uint32_t store_retention_s_{0};
+  uint8_t workers_{1};
+  uint16_t worker_threads_{0};
+  float max_rtf_{0.8};
+  uint8_t capture_threads_{0};
+  int16_t capture_cpu_{-1};
+  uint8_t capture_priority_{0};
+  std::string inference_cpus_;
+  uint16_t metrics_port_{0};
+  std::string trace_file_;
+  std::string control_socket_;
 };
 
 #endif
@@ -0,0 +1,217 @@
+//
+//  control.cpp
+//
+//  Copyright (c) 2019 2025 Andrea Bondavalli. All rights reserved.
+//
+//  This program is free software: you can redistribute it and/or modify
+//  it under the terms of the MIT license
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+//
+
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <sstream>
+
+#include "control.hpp"
+#include "log.hpp"
+#include "transcriber.hpp"
+
+bool ControlServer::start(const std::string &path,
+                          const std::vector<Transcriber *> &transcribers) {
+  struct sockaddr_un addr;
+  std::memset(&addr, 0, sizeof(addr));
+  if (path.size() >= sizeof(addr.sun_path)) {
+    BOOST_LOG_TRIVIAL(error) << "control:: socket path too long " << path;
+    return false;
+  }
+  addr.sun_family = AF_UNIX;
+  std::strcpy(addr.sun_path, path.c_str());
+
+  fd_ = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (fd_ < 0) {
+    BOOST_LOG_TRIVIAL(error) << "control:: cannot create socket: "
+                             << std::strerror(errno);
+    return false;
+  }
+  /* a socket left by a previous run */
+  ::unlink(path.c_str());
+  if (bind(fd_, reinterpret_cast<struct sockaddr *>(&addr), sizeof(addr)) <
+          0 ||
+      listen(fd_, 4) < 0) {
+    BOOST_LOG_TRIVIAL(error) << "control:: cannot listen on " << path << ": "
+                             << std::strerror(errno);
+    ::close(fd_);
+    fd_ = -1;
+    return false;
+  }
+  /* owner and group only, a client can pause the transcription */
+  chmod(path.c_str(), 0660);
+
+  path_ = path;
+  transcribers_ = transcribers;
+  running_ = true;
+  thread_ = std::thread([this]() { serve(); });
+  BOOST_LOG_TRIVIAL(info) << "control:: listening on " << path;
+  return true;
+}
+
+void ControlServer::stop() {
+  if (running_) {
+    running_ = false;
+    thread_.join();
+    ::close(fd_);
+    fd_ = -1;
+    ::unlink(path_.c_str());
+  }
+}
+
+void ControlServer::serve() {
+  std::vector<Client> clients;
+  std::vector<struct pollfd> pfds;
+  while (running_) {
+    pfds.assign(1, {fd_, POLLIN, 0});
+    for (const auto &client : clients) {
+      pfds.push_back({client.fd, POLLIN, 0});
+    }
+    if (poll(pfds.data(), pfds.size(), 200) <= 0) {
+      continue;
+    }
+
+    for (size_t i = clients.size(); i > 0; i--) {
+      if (pfds[i].revents && !receive(clients[i - 1])) {
+        ::close(clients[i - 1].fd);
+        clients.erase(clients.begin() + i - 1);
+      }
+    }
+    if (pfds[0].revents & POLLIN) {
+      int fd = accept4(fd_, nullptr, nullptr, SOCK_CLOEXEC);
+      if (fd < 0) {
+        continue;
+      }
+      if (clients.size() >= max_clients) {
+        BOOST_LOG_TRIVIAL(warning) << "control:: too many clients";
+        ::close(fd);
+        continue;
+      }
+      clients.push_back({fd, {}});
+    }
+  }
+  for (const auto &client : clients) {
+    ::close(client.fd);
+  }
+}
+
+bool ControlServer::receive(Client &client) {
+  char buf[256];
+  ssize_t r = read(client.fd, buf, sizeof(buf));
+  if (r <= 0) {
+    return false;
+  }
+  client.input.append(buf, r);
+
+  size_t pos;
+  while ((pos = client.input.find('\n')) != std::string::npos) {
+    std::string line = client.input.substr(0, pos);
+    client.input.erase(0, pos + 1);
+    if (!line.empty() && line.back() == '\r') {
+      line.pop_back();
+    }
+    if (line.empty()) {
+      continue;
+    }
+    std::string reply = execute(line);
+    size_t done{0};
+    while (done < reply.size()) {
+      ssize_t w = send(client.fd, reply.data() + done, reply.size() - done,
+                       MSG_NOSIGNAL);
+      if (w <= 0) {
+        return false;
+      }
+      done += w;
+    }
+  }
+  return client.input.size() <= max_line;
+}
+
+std::string ControlServer::segments(const Transcriber &transcriber,
+                                    uint64_t seq) {
+  std::vector<TextSegment> segments;
+  transcriber.get_segments_since(seq, segments, max_segments);
+  const std::string &name = transcriber.get_name();
+  std::ostringstream os;
+  for (auto &segment : segments) {
+    /* a reply line per segment */
+    std::replace(segment.text.begin(), segment.text.end(), '\n', ' ');
+    os << name << " " << segment.seq << " " << segment.t0 << " "
+       << segment.t1 << " " << (segment.stream.empty() ? "-" : segment.stream)
+       << " " << segment.text << "\n";
+  }
+  /* where to ask from next, past the segments not returned */
+  uint64_t last = segments.empty() ? transcriber.get_last_seq()
+                                   : segments.back().seq;
+  os << name << " last " << std::max(last, seq) << "\n";
+  return os.str();
+}
+
+std::string ControlServer::execute(const std::string &line) {
+  std::istringstream is(line);
+  std::string command, key, value, pipeline;
+  uint64_t seq{0};
+  is >> command;
+  if (command == "set") {
+    is >> key >> value;
+    if (value.empty()) {
+      return "error usage: set <key> <value> [pipeline]\n";
+    }
+  } else if (command == "segments") {
+    if (!(is >> seq)) {
+      return "error usage: segments <seq> [pipeline]\n";
+    }
+  }
+  is >> pipeline;
+
+  std::vector<Transcriber *> targets;
+  for (auto transcriber : transcribers_) {
+    if (pipeline.empty() || transcriber->get_name() == pipeline) {
+      targets.push_back(transcriber);
+    }
+  }
+  if (targets.empty()) {
+    return "error unknown pipeline " + pipeline + "\n";
+  }
+  BOOST_LOG_TRIVIAL(debug) << "control:: " << line;
+
+  std::string reply;
+  for (auto transcriber : targets) {
+    const std::string &name = transcriber->get_name();
+    if (command == "get") {
+      reply += name + " " + transcriber->get_settings().to_string() + "\n";
+    } else if (command == "set") {
+      std::string error;
+      if (!transcriber->set_setting(key, value, error)) {
+        return reply + "error " + error + "\n";
+      }
+    } else if (command == "pause" || command == "resume") {
+      transcriber->pause(command == "pause");
+    } else if (command == "flush") {
+      transcriber->flush();
+    } else if (command == "stats") {
+      reply += name + " " + transcriber->get_stats() + "\n";
+    } else if (command == "segments") {
+      reply += segments(*transcriber, seq);
+    } else {
+      return "error unknown command " + command + "\n";
+    }
+  }
+  return reply + "ok\n";
+}
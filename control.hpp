@@ -0,0 +1,71 @@
+//
+//  control.hpp
+//
+//  Copyright (c) 2019 2025 Andrea Bondavalli. All rights reserved.
+//
+//  This program is free software: you can redistribute it and/or modify
+//  it under the terms of the MIT license
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+//
+
+#ifndef _CONTROL_HPP_
+#define _CONTROL_HPP_
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <thread>
+#include <vector>
+
+class Transcriber;
+
+/*
+ * Runtime control on a local UNIX socket, one command per line:
+ *   get [pipeline]                  current settings
+ *   set <key> <value> [pipeline]    change a setting, see Settings
+ *   pause|resume|flush [pipeline]   drop or transcribe the audio
+ *   stats [pipeline]                pipeline counters
+ *   segments <seq> [pipeline]       transcript segments after seq, a
+ *                                   "<seq> <t0> <t1> <stream> <text>"
+ *                                   line each then "last <seq>"
+ * Commands apply to all the pipelines when none is given. Every reply
+ * is made of lines starting with the pipeline name, if any, ended by
+ * "ok" or "error <reason>".
+ */
+class ControlServer {
+public:
+  ControlServer() = default;
+  ControlServer(const ControlServer &) = delete;
+  ~ControlServer() { stop(); }
+
+  bool start(const std::string &path,
+             const std::vector<Transcriber *> &transcribers);
+  void stop();
+
+private:
+  struct Client {
+    int fd;
+    std::string input;
+  };
+  constexpr static size_t max_clients = 8;
+  constexpr static size_t max_line = 1024;
+  /* segments per pipeline in a reply, ask again from the last one */
+  constexpr static size_t max_segments = 256;
+
+  void serve();
+  /* false to close the client */
+  bool receive(Client &client);
+  std::string execute(const std::string &line);
+  std::string segments(const Transcriber &transcriber, uint64_t seq);
+
+  int fd_{-1};
+  std::string path_;
+  std::vector<Transcriber *> transcribers_;
+  std::atomic_bool running_{false};
+  std::thread thread_;
+};
+
+#endif
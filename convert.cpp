@@ -0,0 +1,696 @@
+//
+//  convert.cpp
+//
+//  Copyright (c) 2019 2025 Andrea Bondavalli. All rights reserved.
+//
+//  This program is free software: you can redistribute it and/or modify
+//  it under the terms of the MIT license
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+//
+
+#include <algorithm>
+#include <cstring>
+
+#include "convert.hpp"
+
+#if defined(__SSE2__)
+#include <immintrin.h>
+#define AVX2_TARGET __attribute__((target("avx2")))
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+namespace {
+
+constexpr float kS16Scale = 1.0f / 32768.0f;
+constexpr float kS24Scale = 1.0f / 8388608.0f;
+constexpr float kS32Scale = 1.0f / 2147483648.0f;
+
+struct Kernel {
+  convert_fn fn{nullptr};
+  const char *name{nullptr};
+};
+
+/* scalar sample decoding, little endian input on any host */
+template <SampleFormat F> struct Pcm;
+
+template <> struct Pcm<SampleFormat::S16_LE> {
+  static constexpr size_t size = 2;
+  static float load(const uint8_t *in) {
+    int16_t pcm = static_cast<int16_t>(in[0] | (in[1] << 8));
+    return static_cast<float>(pcm) * kS16Scale;
+  }
+};
+
+template <> struct Pcm<SampleFormat::S24_3LE> {
+  static constexpr size_t size = 3;
+  static float load(const uint8_t *in) {
+    /* place the 24 bits in the upper bytes and shift back to sign extend */
+    int32_t pcm = static_cast<int32_t>(static_cast<uint32_t>(in[0]) << 8 |
+                                       static_cast<uint32_t>(in[1]) << 16 |
+                                       static_cast<uint32_t>(in[2]) << 24) >>
+                  8;
+    return static_cast<float>(pcm) * kS24Scale;
+  }
+};
+
+template <> struct Pcm<SampleFormat::S32_LE> {
+  static constexpr size_t size = 4;
+  static float load(const uint8_t *in) {
+    int32_t pcm = static_cast<int32_t>(
+        static_cast<uint32_t>(in[0]) | static_cast<uint32_t>(in[1]) << 8 |
+        static_cast<uint32_t>(in[2]) << 16 |
+        static_cast<uint32_t>(in[3]) << 24);
+    return static_cast<float>(pcm) * kS32Scale;
+  }
+};
+
+template <> struct Pcm<SampleFormat::FLOAT_LE> {
+  static constexpr size_t size = 4;
+  static float load(const uint8_t *in) {
+    float pcm;
+    std::memcpy(&pcm, in, sizeof(pcm));
+    return pcm;
+  }
+};
+
+/* channel count known at compile time when C is not 0 */
+template <SampleFormat F, uint8_t C>
+void scalar_kernel(const uint8_t *in, float *out, size_t frames,
+                   uint8_t channels) {
+  const size_t ch = C ? C : channels;
+  for (size_t f = 0; f < frames; f++) {
+    float sum{0};
+    for (size_t c = 0; c < ch; c++) {
+      sum += Pcm<F>::load(in);
+      in += Pcm<F>::size;
+    }
+    out[f] = sum;
+  }
+}
+
+/* convert the frames left over by a vector kernel */
+template <SampleFormat F>
+inline void scalar_tail(const uint8_t *in, float *out, size_t done,
+                        size_t frames, size_t channels) {
+  scalar_kernel<F, 0>(in + done * channels * Pcm<F>::size, out + done,
+                      frames - done, channels);
+}
+
+template <SampleFormat F> Kernel select_scalar(uint8_t channels) {
+  switch (channels) {
+  case 1:
+    return {scalar_kernel<F, 1>, "scalar mono"};
+  case 2:
+    return {scalar_kernel<F, 2>, "scalar stereo"};
+  case 4:
+    return {scalar_kernel<F, 4>, "scalar 4ch"};
+  case 6:
+    return {scalar_kernel<F, 6>, "scalar 6ch"};
+  case 8:
+    return {scalar_kernel<F, 8>, "scalar 8ch"};
+  case 16:
+    return {scalar_kernel<F, 16>, "scalar 16ch"};
+  case 32:
+    return {scalar_kernel<F, 32>, "scalar 32ch"};
+  default:
+    return {scalar_kernel<F, 0>, "scalar"};
+  }
+}
+
+template <SampleFormat F>
+void group_kernel(const uint8_t *in, float *const *out, size_t frames,
+                  uint8_t channels, const uint8_t *groups,
+                  uint8_t groups_num) {
+  for (size_t f = 0; f < frames; f++) {
+    for (size_t g = 0; g < groups_num; g++) {
+      out[g][f] = 0;
+    }
+    for (size_t c = 0; c < channels; c++) {
+      out[groups[c]][f] += Pcm<F>::load(in);
+      in += Pcm<F>::size;
+    }
+  }
+}
+
+/* one group per channel */
+template <SampleFormat F>
+void deinterleave_kernel(const uint8_t *in, float *const *out, size_t frames,
+                         uint8_t channels, const uint8_t *groups,
+                         uint8_t groups_num) {
+  for (size_t f = 0; f < frames; f++) {
+    for (size_t c = 0; c < channels; c++) {
+      out[c][f] = Pcm<F>::load(in);
+      in += Pcm<F>::size;
+    }
+  }
+}
+
+template <SampleFormat F> group_convert_fn select_group(bool deinterleave) {
+  return deinterleave ? deinterleave_kernel<F> : group_kernel<F>;
+}
+
+group_convert_fn select_group(SampleFormat format, bool deinterleave) {
+  switch (format) {
+  case SampleFormat::S16_LE:
+    return select_group<SampleFormat::S16_LE>(deinterleave);
+  case SampleFormat::S24_3LE:
+    return select_group<SampleFormat::S24_3LE>(deinterleave);
+  case SampleFormat::S32_LE:
+    return select_group<SampleFormat::S32_LE>(deinterleave);
+  case SampleFormat::FLOAT_LE:
+    return select_group<SampleFormat::FLOAT_LE>(deinterleave);
+  }
+  return nullptr;
+}
+
+Kernel select_scalar(SampleFormat format, uint8_t channels) {
+  switch (format) {
+  case SampleFormat::S16_LE:
+    return select_scalar<SampleFormat::S16_LE>(channels);
+  case SampleFormat::S24_3LE:
+    return select_scalar<SampleFormat::S24_3LE>(channels);
+  case SampleFormat::S32_LE:
+    return select_scalar<SampleFormat::S32_LE>(channels);
+  case SampleFormat::FLOAT_LE:
+    return select_scalar<SampleFormat::FLOAT_LE>(channels);
+  }
+  return {};
+}
+
+/* pick the specialization for the common channel counts */
+template <template <uint8_t> class K> convert_fn pick(uint8_t channels) {
+  switch (channels) {
+  case 8:
+    return K<8>::run;
+  case 16:
+    return K<16>::run;
+  case 32:
+    return K<32>::run;
+  default:
+    return K<0>::run;
+  }
+}
+
+#if defined(__SSE2__)
+
+/* horizontal sums of four vectors: { sum(a), sum(b), sum(c), sum(d) } */
+inline __m128i sse2_hadd4(__m128i a, __m128i b, __m128i c, __m128i d) {
+  __m128i ab = _mm_add_epi32(_mm_unpacklo_epi32(a, b),
+                             _mm_unpackhi_epi32(a, b));
+  __m128i cd = _mm_add_epi32(_mm_unpacklo_epi32(c, d),
+                             _mm_unpackhi_epi32(c, d));
+  return _mm_add_epi32(_mm_unpacklo_epi64(ab, cd), _mm_unpackhi_epi64(ab, cd));
+}
+
+inline __m128 sse2_hadd4(__m128 a, __m128 b, __m128 c, __m128 d) {
+  __m128 ab = _mm_add_ps(_mm_unpacklo_ps(a, b), _mm_unpackhi_ps(a, b));
+  __m128 cd = _mm_add_ps(_mm_unpacklo_ps(c, d), _mm_unpackhi_ps(c, d));
+  return _mm_add_ps(_mm_movelh_ps(ab, cd), _mm_movehl_ps(cd, ab));
+}
+
+/* four S32_LE or FLOAT_LE samples as float */
+template <SampleFormat F> inline __m128 sse2_load4(const uint8_t *in) {
+  if constexpr (F == SampleFormat::FLOAT_LE) {
+    return _mm_loadu_ps(reinterpret_cast<const float *>(in));
+  } else {
+    return _mm_mul_ps(_mm_cvtepi32_ps(_mm_loadu_si128(
+                          reinterpret_cast<const __m128i *>(in))),
+                      _mm_set1_ps(kS32Scale));
+  }
+}
+
+void s16_mono_sse2(const uint8_t *in, float *out, size_t frames,
+                   uint8_t channels) {
+  const __m128 scale = _mm_set1_ps(kS16Scale);
+  size_t f = 0;
+  for (; f + 8 <= frames; f += 8) {
+    __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(in + f * 2));
+    /* sign extend to 32 bits */
+    __m128i lo = _mm_srai_epi32(_mm_unpacklo_epi16(v, v), 16);
+    __m128i hi = _mm_srai_epi32(_mm_unpackhi_epi16(v, v), 16);
+    _mm_storeu_ps(out + f, _mm_mul_ps(_mm_cvtepi32_ps(lo), scale));
+    _mm_storeu_ps(out + f + 4, _mm_mul_ps(_mm_cvtepi32_ps(hi), scale));
+  }
+  scalar_tail<SampleFormat::S16_LE>(in, out, f, frames, 1);
+}
+
+void s16_stereo_sse2(const uint8_t *in, float *out, size_t frames,
+                     uint8_t channels) {
+  const __m128 scale = _mm_set1_ps(kS16Scale);
+  const __m128i ones = _mm_set1_epi16(1);
+  size_t f = 0;
+  for (; f + 4 <= frames; f += 4) {
+    __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(in + f * 4));
+    /* madd sums the adjacent left and right samples */
+    __m128i sum = _mm_madd_epi16(v, ones);
+    _mm_storeu_ps(out + f, _mm_mul_ps(_mm_cvtepi32_ps(sum), scale));
+  }
+  scalar_tail<SampleFormat::S16_LE>(in, out, f, frames, 2);
+}
+
+/* multiple of 8 channels, four frames per iteration */
+template <uint8_t C> struct S16Multi8Sse2 {
+  static void run(const uint8_t *in, float *out, size_t frames,
+                  uint8_t channels) {
+    const size_t ch = C ? C : channels;
+    const size_t stride = ch * 2;
+    const __m128 scale = _mm_set1_ps(kS16Scale);
+    const __m128i ones = _mm_set1_epi16(1);
+    size_t f = 0;
+    for (; f + 4 <= frames; f += 4) {
+      __m128i acc[4];
+      for (size_t k = 0; k < 4; k++) {
+        const uint8_t *p = in + (f + k) * stride;
+        acc[k] = _mm_setzero_si128();
+        for (size_t c = 0; c < ch; c += 8) {
+          __m128i v =
+              _mm_loadu_si128(reinterpret_cast<const __m128i *>(p + c * 2));
+          acc[k] = _mm_add_epi32(acc[k], _mm_madd_epi16(v, ones));
+        }
+      }
+      __m128i sum = sse2_hadd4(acc[0], acc[1], acc[2], acc[3]);
+      _mm_storeu_ps(out + f, _mm_mul_ps(_mm_cvtepi32_ps(sum), scale));
+    }
+    scalar_tail<SampleFormat::S16_LE>(in, out, f, frames, ch);
+  }
+};
+
+template <SampleFormat F>
+void pcm32_mono_sse2(const uint8_t *in, float *out, size_t frames,
+                     uint8_t channels) {
+  size_t f = 0;
+  for (; f + 4 <= frames; f += 4) {
+    _mm_storeu_ps(out + f, sse2_load4<F>(in + f * 4));
+  }
+  scalar_tail<F>(in, out, f, frames, 1);
+}
+
+template <SampleFormat F>
+void pcm32_stereo_sse2(const uint8_t *in, float *out, size_t frames,
+                       uint8_t channels) {
+  size_t f = 0;
+  for (; f + 4 <= frames; f += 4) {
+    __m128 a = sse2_load4<F>(in + f * 8);
+    __m128 b = sse2_load4<F>(in + f * 8 + 16);
+    /* deinterleave left and right of the four frames and sum them */
+    __m128 left = _mm_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0));
+    __m128 right = _mm_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1));
+    _mm_storeu_ps(out + f, _mm_add_ps(left, right));
+  }
+  scalar_tail<F>(in, out, f, frames, 2);
+}
+
+/* multiple of 4 channels, four frames per iteration */
+template <SampleFormat F> struct Pcm32Multi4Sse2 {
+  template <uint8_t C> struct K {
+    static void run(const uint8_t *in, float *out, size_t frames,
+                    uint8_t channels) {
+      const size_t ch = C ? C : channels;
+      const size_t stride = ch * 4;
+      size_t f = 0;
+      for (; f + 4 <= frames; f += 4) {
+        __m128 acc[4];
+        for (size_t k = 0; k < 4; k++) {
+          const uint8_t *p = in + (f + k) * stride;
+          acc[k] = _mm_setzero_ps();
+          for (size_t c = 0; c < ch; c += 4) {
+            acc[k] = _mm_add_ps(acc[k], sse2_load4<F>(p + c * 4));
+          }
+        }
+        _mm_storeu_ps(out + f, sse2_hadd4(acc[0], acc[1], acc[2], acc[3]));
+      }
+      scalar_tail<F>(in, out, f, frames, ch);
+    }
+  };
+};
+
+template <SampleFormat F> Kernel select_pcm32_sse2(uint8_t channels) {
+  if (channels == 1)
+    return {pcm32_mono_sse2<F>, "sse2 mono"};
+  if (channels == 2)
+    return {pcm32_stereo_sse2<F>, "sse2 stereo"};
+  if (channels % 4 == 0)
+    return {pick<Pcm32Multi4Sse2<F>::template K>(channels), "sse2 x4"};
+  return {};
+}
+
+Kernel select_sse2(SampleFormat format, uint8_t channels) {
+  switch (format) {
+  case SampleFormat::S16_LE:
+    if (channels == 1)
+      return {s16_mono_sse2, "sse2 mono"};
+    if (channels == 2)
+      return {s16_stereo_sse2, "sse2 stereo"};
+    if (channels % 8 == 0)
+      return {pick<S16Multi8Sse2>(channels), "sse2 x8"};
+    break;
+  case SampleFormat::S32_LE:
+    return select_pcm32_sse2<SampleFormat::S32_LE>(channels);
+  case SampleFormat::FLOAT_LE:
+    return select_pcm32_sse2<SampleFormat::FLOAT_LE>(channels);
+  default:
+    break;
+  }
+  return {};
+}
+
+/* AVX2 kernels, selected at runtime when the CPU supports them */
+
+template <SampleFormat F>
+AVX2_TARGET inline __m256 avx2_load8(const uint8_t *in) {
+  if constexpr (F == SampleFormat::FLOAT_LE) {
+    return _mm256_loadu_ps(reinterpret_cast<const float *>(in));
+  } else {
+    return _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_loadu_si256(
+                             reinterpret_cast<const __m256i *>(in))),
+                         _mm256_set1_ps(kS32Scale));
+  }
+}
+
+AVX2_TARGET void s16_mono_avx2(const uint8_t *in, float *out, size_t frames,
+                               uint8_t channels) {
+  const __m256 scale = _mm256_set1_ps(kS16Scale);
+  size_t f = 0;
+  for (; f + 8 <= frames; f += 8) {
+    __m256i v = _mm256_cvtepi16_epi32(
+        _mm_loadu_si128(reinterpret_cast<const __m128i *>(in + f * 2)));
+    _mm256_storeu_ps(out + f, _mm256_mul_ps(_mm256_cvtepi32_ps(v), scale));
+  }
+  scalar_tail<SampleFormat::S16_LE>(in, out, f, frames, 1);
+}
+
+AVX2_TARGET void s16_stereo_avx2(const uint8_t *in, float *out, size_t frames,
+                                 uint8_t channels) {
+  const __m256 scale = _mm256_set1_ps(kS16Scale);
+  const __m256i ones = _mm256_set1_epi16(1);
+  size_t f = 0;
+  for (; f + 8 <= frames; f += 8) {
+    __m256i v =
+        _mm256_loadu_si256(reinterpret_cast<const __m256i *>(in + f * 4));
+    __m256i sum = _mm256_madd_epi16(v, ones);
+    _mm256_storeu_ps(out + f, _mm256_mul_ps(_mm256_cvtepi32_ps(sum), scale));
+  }
+  scalar_tail<SampleFormat::S16_LE>(in, out, f, frames, 2);
+}
+
+/* multiple of 16 channels, four frames per iteration */
+template <uint8_t C> struct S16Multi16Avx2 {
+  AVX2_TARGET static void run(const uint8_t *in, float *out, size_t frames,
+                              uint8_t channels) {
+    const size_t ch = C ? C : channels;
+    const size_t stride = ch * 2;
+    const __m128 scale = _mm_set1_ps(kS16Scale);
+    const __m256i ones = _mm256_set1_epi16(1);
+    size_t f = 0;
+    for (; f + 4 <= frames; f += 4) {
+      __m128i acc[4];
+      for (size_t k = 0; k < 4; k++) {
+        const uint8_t *p = in + (f + k) * stride;
+        __m256i acc256 = _mm256_setzero_si256();
+        for (size_t c = 0; c < ch; c += 16) {
+          __m256i v =
+              _mm256_loadu_si256(reinterpret_cast<const __m256i *>(p + c * 2));
+          acc256 = _mm256_add_epi32(acc256, _mm256_madd_epi16(v, ones));
+        }
+        acc[k] = _mm_add_epi32(_mm256_castsi256_si128(acc256),
+                               _mm256_extracti128_si256(acc256, 1));
+      }
+      __m128i sum = sse2_hadd4(acc[0], acc[1], acc[2], acc[3]);
+      _mm_storeu_ps(out + f, _mm_mul_ps(_mm_cvtepi32_ps(sum), scale));
+    }
+    scalar_tail<SampleFormat::S16_LE>(in, out, f, frames, ch);
+  }
+};
+
+template <SampleFormat F>
+AVX2_TARGET void pcm32_mono_avx2(const uint8_t *in, float *out, size_t frames,
+                                 uint8_t channels) {
+  size_t f = 0;
+  for (; f + 8 <= frames; f += 8) {
+    _mm256_storeu_ps(out + f, avx2_load8<F>(in + f * 4));
+  }
+  scalar_tail<F>(in, out, f, frames, 1);
+}
+
+/* multiple of 8 channels, four frames per iteration */
+template <SampleFormat F> struct Pcm32Multi8Avx2 {
+  template <uint8_t C> struct K {
+    AVX2_TARGET static void run(const uint8_t *in, float *out, size_t frames,
+                                uint8_t channels) {
+      const size_t ch = C ? C : channels;
+      const size_t stride = ch * 4;
+      size_t f = 0;
+      for (; f + 4 <= frames; f += 4) {
+        __m128 acc[4];
+        for (size_t k = 0; k < 4; k++) {
+          const uint8_t *p = in + (f + k) * stride;
+          __m256 acc256 = _mm256_setzero_ps();
+          for (size_t c = 0; c < ch; c += 8) {
+            acc256 = _mm256_add_ps(acc256, avx2_load8<F>(p + c * 4));
+          }
+          acc[k] = _mm_add_ps(_mm256_castps256_ps128(acc256),
+                              _mm256_extractf128_ps(acc256, 1));
+        }
+        _mm_storeu_ps(out + f, sse2_hadd4(acc[0], acc[1], acc[2], acc[3]));
+      }
+      scalar_tail<F>(in, out, f, frames, ch);
+    }
+  };
+};
+
+template <SampleFormat F> Kernel select_pcm32_avx2(uint8_t channels) {
+  if (channels == 1)
+    return {pcm32_mono_avx2<F>, "avx2 mono"};
+  if (channels % 8 == 0)
+    return {pick<Pcm32Multi8Avx2<F>::template K>(channels), "avx2 x8"};
+  return {};
+}
+
+Kernel select_avx2(SampleFormat format, uint8_t channels) {
+  switch (format) {
+  case SampleFormat::S16_LE:
+    if (channels == 1)
+      return {s16_mono_avx2, "avx2 mono"};
+    if (channels == 2)
+      return {s16_stereo_avx2, "avx2 stereo"};
+    if (channels % 16 == 0)
+      return {pick<S16Multi16Avx2>(channels), "avx2 x16"};
+    break;
+  case SampleFormat::S32_LE:
+    return select_pcm32_avx2<SampleFormat::S32_LE>(channels);
+  case SampleFormat::FLOAT_LE:
+    return select_pcm32_avx2<SampleFormat::FLOAT_LE>(channels);
+  default:
+    break;
+  }
+  return {};
+}
+
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+
+template <SampleFormat F> inline float32x4_t neon_load4(const uint8_t *in) {
+  if constexpr (F == SampleFormat::FLOAT_LE) {
+    return vld1q_f32(reinterpret_cast<const float *>(in));
+  } else {
+    return vmulq_n_f32(
+        vcvtq_f32_s32(vld1q_s32(reinterpret_cast<const int32_t *>(in))),
+        kS32Scale);
+  }
+}
+
+void s16_mono_neon(const uint8_t *in, float *out, size_t frames,
+                   uint8_t channels) {
+  size_t f = 0;
+  for (; f + 8 <= frames; f += 8) {
+    int16x8_t v = vld1q_s16(reinterpret_cast<const int16_t *>(in + f * 2));
+    vst1q_f32(out + f, vmulq_n_f32(vcvtq_f32_s32(vmovl_s16(vget_low_s16(v))),
+                                   kS16Scale));
+    vst1q_f32(out + f + 4,
+              vmulq_n_f32(vcvtq_f32_s32(vmovl_high_s16(v)), kS16Scale));
+  }
+  scalar_tail<SampleFormat::S16_LE>(in, out, f, frames, 1);
+}
+
+void s16_stereo_neon(const uint8_t *in, float *out, size_t frames,
+                     uint8_t channels) {
+  size_t f = 0;
+  for (; f + 8 <= frames; f += 8) {
+    /* vld2 deinterleaves left and right */
+    int16x8x2_t v = vld2q_s16(reinterpret_cast<const int16_t *>(in + f * 4));
+    int32x4_t lo = vaddl_s16(vget_low_s16(v.val[0]), vget_low_s16(v.val[1]));
+    int32x4_t hi = vaddl_high_s16(v.val[0], v.val[1]);
+    vst1q_f32(out + f, vmulq_n_f32(vcvtq_f32_s32(lo), kS16Scale));
+    vst1q_f32(out + f + 4, vmulq_n_f32(vcvtq_f32_s32(hi), kS16Scale));
+  }
+  scalar_tail<SampleFormat::S16_LE>(in, out, f, frames, 2);
+}
+
+/* multiple of 8 channels */
+template <uint8_t C> struct S16Multi8Neon {
+  static void run(const uint8_t *in, float *out, size_t frames,
+                  uint8_t channels) {
+    const size_t ch = C ? C : channels;
+    const int16_t *p = reinterpret_cast<const int16_t *>(in);
+    for (size_t f = 0; f < frames; f++) {
+      int32x4_t acc = vdupq_n_s32(0);
+      for (size_t c = 0; c < ch; c += 8) {
+        acc = vpadalq_s16(acc, vld1q_s16(p + c));
+      }
+      out[f] = static_cast<float>(vaddvq_s32(acc)) * kS16Scale;
+      p += ch;
+    }
+  }
+};
+
+template <SampleFormat F>
+void pcm32_mono_neon(const uint8_t *in, float *out, size_t frames,
+                     uint8_t channels) {
+  size_t f = 0;
+  for (; f + 4 <= frames; f += 4) {
+    vst1q_f32(out + f, neon_load4<F>(in + f * 4));
+  }
+  scalar_tail<F>(in, out, f, frames, 1);
+}
+
+template <SampleFormat F>
+void pcm32_stereo_neon(const uint8_t *in, float *out, size_t frames,
+                       uint8_t channels) {
+  size_t f = 0;
+  for (; f + 4 <= frames; f += 4) {
+    if constexpr (F == SampleFormat::FLOAT_LE) {
+      float32x4x2_t v = vld2q_f32(reinterpret_cast<const float *>(in + f * 8));
+      vst1q_f32(out + f, vaddq_f32(v.val[0], v.val[1]));
+    } else {
+      int32x4x2_t v = vld2q_s32(reinterpret_cast<const int32_t *>(in + f * 8));
+      float32x4_t sum = vaddq_f32(vcvtq_f32_s32(v.val[0]),
+                                  vcvtq_f32_s32(v.val[1]));
+      vst1q_f32(out + f, vmulq_n_f32(sum, kS32Scale));
+    }
+  }
+  scalar_tail<F>(in, out, f, frames, 2);
+}
+
+/* multiple of 4 channels */
+template <SampleFormat F> struct Pcm32Multi4Neon {
+  template <uint8_t C> struct K {
+    static void run(const uint8_t *in, float *out, size_t frames,
+                    uint8_t channels) {
+      const size_t ch = C ? C : channels;
+      for (size_t f = 0; f < frames; f++) {
+        float32x4_t acc = vdupq_n_f32(0);
+        for (size_t c = 0; c < ch; c += 4) {
+          acc = vaddq_f32(acc, neon_load4<F>(in + c * 4));
+        }
+        out[f] = vaddvq_f32(acc);
+        in += ch * 4;
+      }
+    }
+  };
+};
+
+template <SampleFormat F> Kernel select_pcm32_neon(uint8_t channels) {
+  if (channels == 1)
+    return {pcm32_mono_neon<F>, "neon mono"};
+  if (channels == 2)
+    return {pcm32_stereo_neon<F>, "neon stereo"};
+  if (channels % 4 == 0)
+    return {pick<Pcm32Multi4Neon<F>::template K>(channels), "neon x4"};
+  return {};
+}
+
+Kernel select_neon(SampleFormat format, uint8_t channels) {
+  switch (format) {
+  case SampleFormat::S16_LE:
+    if (channels == 1)
+      return {s16_mono_neon, "neon mono"};
+    if (channels == 2)
+      return {s16_stereo_neon, "neon stereo"};
+    if (channels % 8 == 0)
+      return {pick<S16Multi8Neon>(channels), "neon x8"};
+    break;
+  case SampleFormat::S32_LE:
+    return select_pcm32_neon<SampleFormat::S32_LE>(channels);
+  case SampleFormat::FLOAT_LE:
+    return select_pcm32_neon<SampleFormat::FLOAT_LE>(channels);
+  default:
+    break;
+  }
+  return {};
+}
+
+#endif
+
+} // namespace
+
+bool Converter::init(SampleFormat format, uint8_t channels,
+                     const std::vector<uint8_t> &groups) {
+  if (channels == 0 || (!groups.empty() && groups.size() != channels)) {
+    return false;
+  }
+
+  groups_ = groups;
+  groups_num_ = 1;
+  bool deinterleave{true};
+  for (size_t c = 0; c < groups_.size(); c++) {
+    groups_num_ = std::max<uint8_t>(groups_num_, groups_[c] + 1);
+    deinterleave = deinterleave && groups_[c] == c;
+  }
+  sample_size_ = sample_size(format);
+  channels_ = channels;
+  if (groups_num_ > 1) {
+    group_fn_ = select_group(format, deinterleave);
+    name_ = deinterleave ? "scalar deinterleave" : "scalar groups";
+    return group_fn_ != nullptr;
+  }
+
+  Kernel kernel;
+#if defined(__SSE2__)
+  if (__builtin_cpu_supports("avx2")) {
+    kernel = select_avx2(format, channels);
+  }
+  if (!kernel.fn) {
+    kernel = select_sse2(format, channels);
+  }
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+  kernel = select_neon(format, channels);
+#endif
+  if (!kernel.fn) {
+    /* S24_3LE and odd channel counts */
+    kernel = select_scalar(format, channels);
+  }
+
+  fn_ = kernel.fn;
+  name_ = kernel.name;
+  return fn_ != nullptr;
+}
+
+uint8_t Converter::sample_size(SampleFormat format) {
+  switch (format) {
+  case SampleFormat::S16_LE:
+    return 2;
+  case SampleFormat::S24_3LE:
+    return 3;
+  case SampleFormat::S32_LE:
+  case SampleFormat::FLOAT_LE:
+    return 4;
+  }
+  return 0;
+}
+
+const char *Converter::format_name(SampleFormat format) {
+  switch (format) {
+  case SampleFormat::S16_LE:
+    return "S16_LE";
+  case SampleFormat::S24_3LE:
+    return "S24_3LE";
+  case SampleFormat::S32_LE:
+    return "S32_LE";
+  case SampleFormat::FLOAT_LE:
+    return "FLOAT_LE";
+  }
+  return "UNKNOWN";
+}
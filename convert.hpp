@@ -0,0 +1,69 @@
+//
+//  convert.hpp
+//
+//  Copyright (c) 2019 2025 Andrea Bondavalli. All rights reserved.
+//
+//  This program is free software: you can redistribute it and/or modify
+//  it under the terms of the MIT license
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+//
+
+#ifndef _CONVERT_HPP_
+#define _CONVERT_HPP_
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+enum class SampleFormat : uint8_t { S16_LE, S24_3LE, S32_LE, FLOAT_LE };
+
+/* interleaved PCM frames to mono float, channels are summed */
+using convert_fn = void (*)(const uint8_t *in, float *out, size_t frames,
+                            uint8_t channels);
+/* interleaved PCM frames to one float plane per group of channels */
+using group_convert_fn = void (*)(const uint8_t *in, float *const *out,
+                                  size_t frames, uint8_t channels,
+                                  const uint8_t *groups, uint8_t groups_num);
+
+class Converter {
+public:
+  Converter() = default;
+
+  /* select the best kernel for the format, channels and running CPU,
+     groups maps each channel to its output plane, empty for downmix */
+  bool init(SampleFormat format, uint8_t channels,
+            const std::vector<uint8_t> &groups = {});
+
+  void convert(const uint8_t *in, float *out, size_t frames) const {
+    fn_(in, out, frames, channels_);
+  }
+  void convert(const uint8_t *in, float *const *out, size_t frames) const {
+    if (groups_num_ == 1) {
+      fn_(in, out[0], frames, channels_);
+    } else {
+      group_fn_(in, out, frames, channels_, groups_.data(), groups_num_);
+    }
+  }
+
+  const char *get_name() const { return name_; }
+  uint8_t get_sample_size() const { return sample_size_; }
+  uint8_t get_channels() const { return channels_; }
+  uint8_t get_groups_num() const { return groups_num_; }
+
+  static uint8_t sample_size(SampleFormat format);
+  static const char *format_name(SampleFormat format);
+
+private:
+  convert_fn fn_{nullptr};
+  group_convert_fn group_fn_{nullptr};
+  std::vector<uint8_t> groups_;
+  uint8_t groups_num_{1};
+  const char *name_{"none"};
+  uint8_t channels_{0};
+  uint8_t sample_size_{0};
+};
+
+#endif
@@ -0,0 +1,244 @@
+//
+//  file_capture.cpp
+//
+//  Copyright (c) 2019 2025 Andrea Bondavalli. All rights reserved.
+//
+//  This program is free software: you can redistribute it and/or modify
+//  it under the terms of the MIT license
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+//
+
+#include <cstring>
+#include <thread>
+
+#include "file_capture.hpp"
+#include "log.hpp"
+
+namespace {
+
+constexpr uint16_t wave_format_pcm = 0x0001;
+constexpr uint16_t wave_format_float = 0x0003;
+constexpr uint16_t wave_format_extensible = 0xfffe;
+
+uint16_t get_le16(const uint8_t *in) { return in[0] | in[1] << 8; }
+
+uint32_t get_le32(const uint8_t *in) {
+  return static_cast<uint32_t>(in[0]) | static_cast<uint32_t>(in[1]) << 8 |
+         static_cast<uint32_t>(in[2]) << 16 |
+         static_cast<uint32_t>(in[3]) << 24;
+}
+
+} // namespace
+
+size_t FileCapture::read_bytes(uint8_t *out, size_t size) {
+  size = std::min<uint64_t>(size, data_left_);
+  size_t done{0};
+  if (pending_offset_ < pending_.size()) {
+    done = std::min(size, pending_.size() - pending_offset_);
+    std::memcpy(out, pending_.data() + pending_offset_, done);
+    pending_offset_ += done;
+  }
+  while (done < size) {
+    size_t r = std::fread(out + done, 1, size - done, file_);
+    if (r == 0) {
+      break;
+    }
+    done += r;
+  }
+  if (data_left_ != UINT64_MAX) {
+    data_left_ -= done;
+  }
+  return done;
+}
+
+bool FileCapture::skip_bytes(size_t size) {
+  /* stdin cannot seek */
+  uint8_t buf[256];
+  while (size > 0) {
+    size_t n = std::min(size, sizeof(buf));
+    if (read_bytes(buf, n) != n) {
+      return false;
+    }
+    size -= n;
+  }
+  return true;
+}
+
+bool FileCapture::read_wav_header(SampleFormat &format, uint8_t &channels,
+                                  uint32_t &rate) {
+  uint8_t riff[12];
+  size_t r = read_bytes(riff, sizeof(riff));
+  if (r < sizeof(riff) || std::memcmp(riff, "RIFF", 4) ||
+      std::memcmp(riff + 8, "WAVE", 4)) {
+    /* raw PCM, replay the probed bytes as audio */
+    pending_.assign(riff, riff + r);
+    pending_offset_ = 0;
+    return true;
+  }
+
+  bool fmt_found{false};
+  while (true) {
+    uint8_t chunk[8];
+    if (read_bytes(chunk, sizeof(chunk)) != sizeof(chunk)) {
+      BOOST_LOG_TRIVIAL(fatal) << "file_capture:: WAV data chunk not found";
+      return false;
+    }
+    uint32_t size = get_le32(chunk + 4);
+    if (!std::memcmp(chunk, "data", 4)) {
+      if (!fmt_found) {
+        BOOST_LOG_TRIVIAL(fatal) << "file_capture:: WAV fmt chunk not found";
+        return false;
+      }
+      /* streamed WAV files may carry no valid data size */
+      data_left_ = (size == 0 || size == UINT32_MAX) ? UINT64_MAX : size;
+      return true;
+    }
+    if (std::memcmp(chunk, "fmt ", 4) || size < 16 || size > 64) {
+      /* chunks are word aligned */
+      if (!skip_bytes(size + (size & 1))) {
+        return false;
+      }
+      continue;
+    }
+
+    uint8_t fmt[64];
+    if (read_bytes(fmt, size + (size & 1)) != size + (size & 1)) {
+      return false;
+    }
+    uint16_t tag = get_le16(fmt);
+    channels = get_le16(fmt + 2);
+    rate = get_le32(fmt + 4);
+    uint16_t bits = get_le16(fmt + 14);
+    uint16_t block_align = get_le16(fmt + 12);
+    if (tag == wave_format_extensible && size >= 26) {
+      /* the sub format GUID starts with the format tag */
+      tag = get_le16(fmt + 24);
+    }
+    if (tag == wave_format_pcm && bits == 16) {
+      format = SampleFormat::S16_LE;
+    } else if (tag == wave_format_pcm && bits == 24 &&
+               block_align == 3 * channels) {
+      format = SampleFormat::S24_3LE;
+    } else if (tag == wave_format_pcm && bits == 32) {
+      format = SampleFormat::S32_LE;
+    } else if (tag == wave_format_float && bits == 32) {
+      format = SampleFormat::FLOAT_LE;
+    } else {
+      BOOST_LOG_TRIVIAL(fatal) << "file_capture:: unsupported WAV format "
+                               << tag << " " << bits << " bits";
+      return false;
+    }
+    fmt_found = true;
+  }
+}
+
+bool FileCapture::open(const std::string &device, uint32_t rate,
+                       uint8_t channels, const std::vector<uint8_t> &groups,
+                       bool mmap) {
+  if (is_open_) {
+    BOOST_LOG_TRIVIAL(error) << "file_capture:: already open";
+    return false;
+  }
+
+  if (device == "stdin") {
+    file_ = stdin;
+  } else {
+    std::string path = device.substr(std::strlen("file:"));
+    file_ = std::fopen(path.c_str(), "rb");
+    if (!file_) {
+      BOOST_LOG_TRIVIAL(fatal) << "file_capture:: cannot open " << path
+                               << " : " << std::strerror(errno);
+      return false;
+    }
+  }
+
+  SampleFormat format{SampleFormat::S16_LE};
+  uint8_t file_channels{channels};
+  /* raw PCM is at the configured device rate */
+  uint32_t file_rate{device_rate_ ? device_rate_ : rate};
+  data_left_ = UINT64_MAX;
+  pending_.clear();
+  pending_offset_ = 0;
+  if (!read_wav_header(format, file_channels, file_rate)) {
+    close();
+    return false;
+  }
+
+  if (file_channels != channels) {
+    if (!groups.empty()) {
+      BOOST_LOG_TRIVIAL(fatal)
+          << "file_capture:: " << (int)file_channels
+          << " channels don't match the channel groups";
+      close();
+      return false;
+    }
+    BOOST_LOG_TRIVIAL(warning) << "file_capture:: using the "
+                               << (int)file_channels << " file channels";
+  }
+  if (!init_converter(format, file_channels, groups)) {
+    BOOST_LOG_TRIVIAL(fatal) << "file_capture:: unsupported format";
+    close();
+    return false;
+  }
+  device_rate_ = file_rate;
+  if (!init_resampler(rate)) {
+    close();
+    return false;
+  }
+
+  bytes_per_frame_ = Converter::sample_size(format) * file_channels;
+  frames_ = 0;
+  eof_ = false;
+  chunk_samples_ = rate / 10;
+  set_chunk_samples(chunk_samples_);
+  BOOST_LOG_TRIVIAL(info) << "file_capture:: replaying " << device << " "
+                          << (paced_ ? "paced" : "unpaced");
+  is_open_ = true;
+  return true;
+}
+
+void FileCapture::set_chunk_samples(snd_pcm_uframes_t chunk_samples) {
+  chunk_samples_ = chunk_samples;
+  buffer_.reset(
+      new uint8_t[max_input_frames(chunk_samples_) * bytes_per_frame_]);
+}
+
+ssize_t FileCapture::read_chunk() {
+  if (eof_) {
+    return -1;
+  }
+  if (frames_ == 0) {
+    start_ = std::chrono::steady_clock::now();
+  }
+
+  size_t size = input_frames(chunk_samples_) * bytes_per_frame_;
+  size_t r = read_bytes(buffer_.get(), size);
+  r -= r % bytes_per_frame_;
+  if (size > 0 && r == 0) {
+    BOOST_LOG_TRIVIAL(info) << "file_capture:: end of input after "
+                            << frames_ << " frames";
+    eof_ = true;
+    return -1;
+  }
+  /* pad the last chunk with silence */
+  std::memset(buffer_.get() + r, 0, size - r);
+  convert(buffer_.get(), size / bytes_per_frame_);
+  frames_ += chunk_samples_;
+
+  if (paced_) {
+    std::this_thread::sleep_until(
+        start_ + std::chrono::microseconds(frames_ * 1000000 / rate_));
+  }
+  return chunk_samples_;
+}
+
+void FileCapture::close() {
+  if (file_ && file_ != stdin) {
+    std::fclose(file_);
+  }
+  file_ = nullptr;
+  is_open_ = false;
+}
@@ -0,0 +1,63 @@
+//
+//  file_capture.hpp
+//
+//  Copyright (c) 2019 2025 Andrea Bondavalli. All rights reserved.
+//
+//  This program is free software: you can redistribute it and/or modify
+//  it under the terms of the MIT license
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+//
+
+#ifndef _FILE_CAPTURE_HPP_
+#define _FILE_CAPTURE_HPP_
+
+#include <chrono>
+#include <cstdio>
+
+#include "capture.hpp"
+
+/*
+ * Replay of a WAV or raw PCM file (device file:<path>) or of stdin
+ * (device stdin). WAV files carry their format and rate, raw PCM is
+ * S16_LE with the configured channels and sample rate; both are
+ * resampled to the output rate when needed. Paced replay delivers the audio in
+ * real time, unpaced replay as fast as the transcription consumes it.
+ */
+class FileCapture : public Capture {
+public:
+  explicit FileCapture(bool paced) : paced_(paced){};
+  ~FileCapture() override { close(); }
+
+  bool open(const std::string &device, uint32_t rate, uint8_t channels,
+            const std::vector<uint8_t> &groups = {},
+            bool mmap = true) override;
+  void close() override;
+
+  void set_chunk_samples(snd_pcm_uframes_t chunk_samples) override;
+  bool is_realtime() const override { return paced_; }
+
+private:
+  ssize_t read_chunk() override;
+  bool read_wav_header(SampleFormat &format, uint8_t &channels,
+                       uint32_t &rate);
+  /* read from the data left in the stream, pending bytes first */
+  size_t read_bytes(uint8_t *out, size_t size);
+  bool skip_bytes(size_t size);
+
+  bool paced_{true};
+  std::FILE *file_{nullptr};
+  /* bytes read probing for a WAV header that belong to raw PCM data */
+  std::vector<uint8_t> pending_;
+  size_t pending_offset_{0};
+  /* bytes left in the WAV data chunk */
+  uint64_t data_left_{UINT64_MAX};
+  size_t bytes_per_frame_{0};
+  uint64_t frames_{0};
+  std::chrono::steady_clock::time_point start_;
+  std::unique_ptr<uint8_t[]> buffer_;
+};
+
+#endif
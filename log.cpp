@@ -17,25 +17,272 @@
 //  along with this program.  If not, see <http://www.gnu.org/licenses/>.
 //
 
-#include <boost/algorithm/string.hpp>
-#include <boost/lexical_cast.hpp>
+#include <pthread.h>
+
 #include <boost/log/core.hpp>
-#include <boost/log/sinks/syslog_backend.hpp>
-#include <boost/log/sources/severity_logger.hpp>
+#include <boost/log/expressions.hpp>
 #include <boost/log/trivial.hpp>
-#include <boost/log/utility/setup/console.hpp>
 
-#include <vector>
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <mutex>
+#include <streambuf>
+#include <string>
+#include <thread>
 
 #include "config.hpp"
 #include "log.hpp"
 
 namespace logging = boost::log;
-namespace src = boost::log::sources;
-namespace sinks = boost::log::sinks;
-namespace keywords = boost::log::keywords;
 
-using sink_t = sinks::synchronous_sink<sinks::syslog_backend>;
+std::atomic<int> log_severity{0};
+
+namespace {
+/* bytes of text per record, longer records are truncated */
+constexpr size_t text_size = 480;
+/* records, a power of 2 */
+constexpr size_t queue_size = 2048;
+
+struct Entry {
+  std::atomic<uint64_t> seq;
+  boost::log::trivial::severity_level level;
+  std::chrono::system_clock::time_point time;
+  pthread_t thread;
+  uint16_t length;
+  char text[text_size];
+};
+
+/* bounded multi producer queue with a sequence per slot (Vyukov) */
+class LogQueue {
+public:
+  LogQueue() {
+    for (size_t i = 0; i < queue_size; i++) {
+      entries_[i].seq.store(i, std::memory_order_relaxed);
+    }
+  }
+
+  Entry *claim() {
+    uint64_t pos = head_.load(std::memory_order_relaxed);
+    while (true) {
+      Entry &entry = entries_[pos & (queue_size - 1)];
+      uint64_t seq = entry.seq.load(std::memory_order_acquire);
+      if (seq == pos) {
+        if (head_.compare_exchange_weak(pos, pos + 1,
+                                        std::memory_order_relaxed)) {
+          return &entry;
+        }
+      } else if (seq < pos) {
+        /* full */
+        return nullptr;
+      } else {
+        pos = head_.load(std::memory_order_relaxed);
+      }
+    }
+  }
+
+  /* returns the position of the entry */
+  uint64_t commit(Entry *entry) {
+    uint64_t pos = entry->seq.load(std::memory_order_relaxed);
+    entry->seq.store(pos + 1, std::memory_order_release);
+    return pos;
+  }
+
+  /* next committed entry in order, nullptr if none */
+  Entry *front() {
+    Entry &entry = entries_[tail_ & (queue_size - 1)];
+    if (entry.seq.load(std::memory_order_acquire) != tail_ + 1) {
+      return nullptr;
+    }
+    return &entry;
+  }
+
+  /* entries claimed and not popped yet, committed or not */
+  bool is_pending() const {
+    return head_.load(std::memory_order_acquire) != tail_;
+  }
+
+  void pop(Entry *entry) {
+    entry->seq.store(tail_ + queue_size, std::memory_order_release);
+    tail_++;
+  }
+
+private:
+  Entry entries_[queue_size];
+  alignas(64) std::atomic<uint64_t> head_{0};
+  alignas(64) uint64_t tail_{0};
+};
+
+/* fixed size buffer, what doesn't fit is dropped */
+class FixedBuf : public std::streambuf {
+public:
+  void reset(char *data, size_t size) { setp(data, data + size); }
+  size_t length() const { return pptr() - pbase(); }
+
+protected:
+  int_type overflow(int_type ch) override { return ch; }
+  std::streamsize xsputn(const char *s, std::streamsize n) override {
+    std::streamsize room = epptr() - pptr();
+    std::streamsize len = std::min(n, room);
+    std::memcpy(pptr(), s, len);
+    pbump(len);
+    return n;
+  }
+};
+
+LogQueue queue;
+std::atomic<bool> running{false};
+std::atomic<uint64_t> dropped{0};
+std::mutex mutex;
+std::condition_variable cv;
+bool stopping{false};
+std::thread thread;
+
+void write_line(FILE *file, const Entry &entry) {
+  char line[text_size + 96];
+  auto time = std::chrono::system_clock::to_time_t(entry.time);
+  auto usec = std::chrono::duration_cast<std::chrono::microseconds>(
+                  entry.time.time_since_epoch())
+                  .count() %
+              1000000;
+  struct tm tm;
+  localtime_r(&time, &tm);
+  size_t len = strftime(line, sizeof(line), "[%Y-%m-%d %H:%M:%S", &tm);
+  /* same layout as the Boost.Log default sink */
+  std::string severity =
+      std::string("[") + boost::log::trivial::to_string(entry.level) + "]";
+  len += snprintf(line + len, sizeof(line) - len, ".%06ld] [0x%016lx] %-9s ",
+                  static_cast<long>(usec),
+                  static_cast<unsigned long>(entry.thread), severity.c_str());
+  len = std::min(len, sizeof(line) - 1);
+  size_t text = std::min<size_t>(entry.length, sizeof(line) - 1 - len);
+  std::memcpy(line + len, entry.text, text);
+  len += text;
+  line[len++] = '\n';
+  fwrite(line, 1, len, file);
+}
+
+void log_loop() {
+  /* bound on the wait for the records claimed before stopping */
+  constexpr auto commit_timeout = std::chrono::milliseconds(100);
+  std::chrono::steady_clock::time_point stopped{};
+  std::unique_lock lock(mutex);
+  while (true) {
+    lock.unlock();
+    size_t written{0};
+    Entry *entry;
+    while ((entry = queue.front()) != nullptr) {
+      write_line(stderr, *entry);
+      queue.pop(entry);
+      written++;
+    }
+    if (uint64_t lost = dropped.exchange(0)) {
+      Entry note;
+      note.level = boost::log::trivial::warning;
+      note.time = std::chrono::system_clock::now();
+      note.thread = pthread_self();
+      note.length = snprintf(note.text, sizeof(note.text),
+                             "log:: %lu records dropped, queue full",
+                             static_cast<unsigned long>(lost));
+      write_line(stderr, note);
+    }
+    if (written) {
+      fflush(stderr);
+    }
+    lock.lock();
+    if (stopping && !queue.front()) {
+      if (!queue.is_pending()) {
+        break;
+      }
+      /* a record is being written, don't spin forever on a thread
+         that never commits */
+      auto now = std::chrono::steady_clock::now();
+      if (stopped == std::chrono::steady_clock::time_point{}) {
+        stopped = now;
+      } else if (now - stopped > commit_timeout) {
+        break;
+      }
+      lock.unlock();
+      std::this_thread::yield();
+      lock.lock();
+      continue;
+    }
+    /* producers never wait, they wake the thread once in a while */
+    cv.wait_for(lock, std::chrono::milliseconds(20));
+  }
+}
+}  // namespace
+
+struct LogRecord::Stream {
+  Stream() : os(&buf) {}
+  FixedBuf buf;
+  std::ostream os;
+  char scratch[text_size];
+  bool busy{false};
+};
+
+LogRecord::LogRecord(boost::log::trivial::severity_level level)
+    : level_(level) {
+  /* constructed once per thread */
+  static thread_local Stream thread_stream;
+  stream_ = &thread_stream;
+  if (stream_->busy) {
+    /* an argument of another record logs */
+    stream_ = new Stream();
+    nested_ = true;
+  }
+  stream_->busy = true;
+
+  Entry *entry = running ? queue.claim() : nullptr;
+  if (entry) {
+    entry_ = entry;
+    stream_->buf.reset(entry->text, sizeof(entry->text));
+  } else {
+    stream_->buf.reset(stream_->scratch, sizeof(stream_->scratch));
+  }
+  std::ostream &os = stream_->os;
+  os.clear();
+  os.flags(std::ios_base::dec | std::ios_base::skipws);
+  os.precision(6);
+  os.width(0);
+  os.fill(' ');
+}
+
+LogRecord::~LogRecord() {
+  Entry *entry = static_cast<Entry *>(entry_);
+  if (entry) {
+    entry->level = level_;
+    entry->time = std::chrono::system_clock::now();
+    entry->thread = pthread_self();
+    entry->length = stream_->buf.length();
+    uint64_t pos = queue.commit(entry);
+    /* wake the log thread on errors and before the queue fills up */
+    if (level_ >= boost::log::trivial::error ||
+        (pos & (queue_size / 4 - 1)) == 0) {
+      cv.notify_one();
+    }
+  } else if (running) {
+    dropped++;
+  } else {
+    Entry line;
+    line.level = level_;
+    line.time = std::chrono::system_clock::now();
+    line.thread = pthread_self();
+    line.length = stream_->buf.length();
+    std::memcpy(line.text, stream_->scratch, line.length);
+    std::unique_lock lock(mutex);
+    write_line(stderr, line);
+  }
+  stream_->busy = false;
+  if (nested_) {
+    delete stream_;
+  }
+}
+
+std::ostream &LogRecord::stream() { return stream_->os; }
 
 void log_init(const Config &config) {
   boost::shared_ptr<logging::core> core = logging::core::get();
@@ -43,4 +290,27 @@ void log_init(const Config &config) {
   core->remove_all_sinks();
   // set log level
   core->set_filter(logging::trivial::severity >= config.get_log_severity());
+  log_severity = config.get_log_severity();
+
+  std::unique_lock lock(mutex);
+  if (!thread.joinable()) {
+    stopping = false;
+    thread = std::thread(log_loop);
+    running = true;
+    std::atexit(log_terminate);
+  }
+}
+
+void log_terminate() {
+  {
+    std::unique_lock lock(mutex);
+    if (!thread.joinable()) {
+      return;
+    }
+    /* the next records are written synchronously */
+    running = false;
+    stopping = true;
+  }
+  cv.notify_one();
+  thread.join();
 }
@@ -20,10 +20,64 @@
 #ifndef _LOG_HPP_
 #define _LOG_HPP_
 
+#include <atomic>
 #include <boost/log/trivial.hpp>
+#include <ostream>
 
 #include "config.hpp"
 
+/* severities below are compiled out, e.g. 2 removes trace and debug */
+#ifndef LOG_MIN_SEVERITY
+#define LOG_MIN_SEVERITY 0
+#endif
+
 void log_init(const Config &config);
+/* write the queued records out and stop the log thread */
+void log_terminate();
+
+extern std::atomic<int> log_severity;
+
+inline bool log_is_enabled(boost::log::trivial::severity_level level) {
+  return level >= LOG_MIN_SEVERITY &&
+         level >= log_severity.load(std::memory_order_relaxed);
+}
+
+/*
+ * Log record formatted in place into a slot of a preallocated lock free
+ * queue, written out by the log thread. A full queue drops the record
+ * instead of blocking the caller. Before log_init() and after
+ * log_terminate() records are written synchronously.
+ */
+class LogRecord {
+public:
+  explicit LogRecord(boost::log::trivial::severity_level level);
+  LogRecord(const LogRecord &) = delete;
+  ~LogRecord();
+
+  std::ostream &stream();
+  explicit operator bool() const { return !done_; }
+  void done() { done_ = true; }
+
+private:
+  struct Stream;
+  boost::log::trivial::severity_level level_;
+  Stream *stream_{nullptr};
+  /* stream of a record logged while formatting another one */
+  bool nested_{false};
+  void *entry_{nullptr};
+  bool done_{false};
+};
+
+/*
+ * The severity is checked before the arguments are evaluated and the
+ * records go through the queue, the call sites keep the Boost.Log syntax.
+ */
+#undef BOOST_LOG_TRIVIAL
+#define BOOST_LOG_TRIVIAL(lvl)                                        \
+  if (!log_is_enabled(::boost::log::trivial::lvl)) {                  \
+  } else                                                              \
+    for (LogRecord log_record_(::boost::log::trivial::lvl); log_record_; \
+         log_record_.done())                                          \
+    log_record_.stream()
 
 #endif
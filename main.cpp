@@ -11,13 +11,22 @@
 //  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
 //
 
+#include <algorithm>
+#include <boost/algorithm/string.hpp>
 #include <boost/program_options.hpp>
+#include <future>
 #include <iostream>
 #include <signal.h>
 #include <thread>
 
+#include "capture_loop.hpp"
 #include "config.hpp"
+#include "control.hpp"
 #include "log.hpp"
+#include "model.hpp"
+#include "scheduler.hpp"
+#include "topology.hpp"
+#include "trace.hpp"
 #include "transcriber.hpp"
 
 namespace po = boost::program_options;
@@ -26,35 +35,130 @@ namespace logging = boost::log;
 
 static const std::string version("whisper-alsa-1.0.0");
 static std::atomic<bool> terminate = false;
+/* logged by the main loop, logging is not async-signal-safe */
+static volatile sig_atomic_t terminate_signal = 0;
 
 void termination_handler(int signum) {
-  BOOST_LOG_TRIVIAL(info) << "main:: got signal " << signum;
+  terminate_signal = signum;
   // Terminate program
   terminate = true;
 }
 
 bool is_terminated() { return terminate.load(); }
 
+static std::atomic<bool> reload = false;
+
+void reload_handler(int signum) {
+  /* the model is loaded again by the main loop */
+  reload = true;
+}
+
+static std::atomic<bool> dump_trace = false;
+
+void trace_handler(int signum) { dump_trace = true; }
+
 const std::string &get_version() { return version; }
 
+/* pipeline overrides of the global options as key=value;key=value */
+bool parse_pipeline(const std::string &spec, Config &config) {
+  std::vector<std::string> options;
+  boost::split(options, spec, boost::is_any_of(";"));
+  for (const auto &option : options) {
+    auto pos = option.find('=');
+    if (pos == std::string::npos) {
+      std::cerr << "invalid pipeline option: " << option << '\n';
+      return false;
+    }
+    std::string key = option.substr(0, pos);
+    std::string value = option.substr(pos + 1);
+    try {
+      if (key == "name") {
+        config.set_pipeline_name(value);
+      } else if (key == "device") {
+        config.set_device_name(value);
+      } else if (key == "channels") {
+        config.set_channels(std::stoi(value));
+      } else if (key == "channel_groups") {
+        config.set_channel_groups(value);
+      } else if (key == "language") {
+        config.set_language(value);
+      } else if (key == "output") {
+        config.set_output(value);
+      } else if (key == "capture_cpu") {
+        config.set_capture_cpu(std::stoi(value));
+      } else if (key == "period_size") {
+        config.set_period_size(std::stoul(value));
+      } else if (key == "periods") {
+        config.set_periods(std::stoul(value));
+      } else if (key == "buffer_time_ms") {
+        config.set_buffer_time_ms(std::stoul(value));
+      } else if (key == "auto_tune") {
+        config.set_auto_tune(std::stoi(value) != 0);
+      } else if (key == "sinks") {
+        /* ';' separates the pipeline keys, sinks are separated by '|' */
+        config.set_sinks(boost::replace_all_copy(value, "|", ","));
+      } else {
+        std::cerr << "unknown pipeline option: " << key << '\n';
+        return false;
+      }
+    } catch (std::exception &e) {
+      std::cerr << "invalid pipeline option value: " << option << '\n';
+      return false;
+    }
+  }
+  if (config.get_pipeline_name().empty()) {
+    config.set_pipeline_name(config.get_device_name());
+  }
+  return true;
+}
+
 int main(int argc, char *argv[]) {
   int rc(EXIT_SUCCESS);
   po::options_description desc("Options");
   desc.add_options()
       ("version,v", "Print version and exit")
-      ("device_name,D", po::value<std::string>()->default_value("default"), "ALSA capture device name")
+      ("device_name,D", po::value<std::string>()->default_value("default"), "ALSA capture device name, file:<path> or stdin to replay audio")
       ("channels,c", po::value<int>()->default_value(2), "ALSA channels to capture")
+      ("channel_groups", po::value<std::string>()->default_value(""), "Channel groups transcribed independently, e.g. 0+1,2 or each")
       ( "sample_rate,r", po::value<int>()->default_value(16000), "ALSA capture sample rate")
       ( "buffer_duration,s", po::value<int>()->default_value(5), "Audio buffer duration in seconds from 2 to 10")
       ( "silence_threshold,t", po::value<float>()->default_value(0.001f, "0.001"), "Audio buffer sample silence threshold")
       ( "buffers_num,n", po::value<int>()->default_value(4), "Audio buffers number from 3 to 10")
       ( "language,l", po::value<std::string>()->default_value("en"), "Whisper default language")
       ( "model,m", po::value<std::string>()->default_value("models/ggml-base.en.bin"), "Whisper model to use")
+      ("draft_model", po::value<std::string>()->default_value(""), "Fast Whisper model emitting provisional text before the model, empty to disable")
+      ("draft_threads", po::value<int>()->default_value(2), "Whisper threads of the draft model worker")
       ("openvino_device,o", po::value<std::string>()->default_value("CPU"), "Whisper openvino device to use")
       ("vad_enabled,e", po::value<bool>()->default_value(false), "Whisper enable/disable VAD")
       ("use_context,x", po::value<bool>()->default_value(false), "Whisper enable/disable token context")
       ("vad_model,a", po::value<std::string>()->default_value("models/ggml-silero-v5.1.2.bin"), "Whisper VAD model to use")
       ("vad_threshold,l", po::value<float>()->default_value(0.1f, "0.1"), "Whisper VAD threshold to use")
+      ("pipeline", po::value<std::vector<std::string>>()->composing(), "Capture pipeline key=value;... (name, device, channels, channel_groups, language, output, sinks, capture_cpu, period_size, periods, buffer_time_ms, auto_tune), repeat for more devices")
+      ("sinks", po::value<std::string>()->default_value(""), "Transcription sinks: stdout, file:<path>, jsonl:<path>, unix:<path>, fifo:<path>, comma separated")
+      ("store_segments", po::value<int>()->default_value(1024), "Transcript segments kept per pipeline for polling clients, 0 to disable")
+      ("store_retention_s", po::value<int>()->default_value(0), "Transcript segments retention in seconds, 0 for no limit")
+      ("use_mmap", po::value<bool>()->default_value(true), "ALSA enable/disable mmap capture access")
+      ("period_size", po::value<int>()->default_value(0), "ALSA period size in frames, 0 for the device default")
+      ("periods", po::value<int>()->default_value(0), "ALSA periods per buffer, 0 for the device default")
+      ("buffer_time_ms", po::value<int>()->default_value(0), "ALSA buffer time in ms, 0 for the device default")
+      ("auto_tune", po::value<bool>()->default_value(false), "ALSA enable/disable the largest safe buffer and chunks aligned to the period")
+      ("paced", po::value<bool>()->default_value(true), "Replay files and stdin in real time, 0 for as fast as possible")
+      ("min_segment_ms", po::value<int>()->default_value(1000), "Minimum audio segment length in ms before cutting at a pause")
+      ("pause_ms", po::value<int>()->default_value(300), "Pause length in ms closing an audio segment")
+      ("workers", po::value<int>()->default_value(1), "Whisper inference workers")
+      ("worker_threads", po::value<int>()->default_value(0), "Whisper threads per worker, 0 to split the cores among the workers")
+      ("capture_threads", po::value<int>()->default_value(0), "Event loop threads reading the ALSA devices, 0 for a thread per device")
+      ("capture_cpu", po::value<int>()->default_value(-1), "CPU of the capture threads, -1 for any CPU")
+      ("capture_priority", po::value<int>()->default_value(0), "SCHED_FIFO priority of the capture threads, 0 for normal scheduling")
+      ("inference_cpus", po::value<std::string>()->default_value(""), "CPUs of the inference threads like 0-3,6, empty for all but the capture CPU")
+      ("max_rtf", po::value<float>()->default_value(0.8f), "Real time factor per inference worker above which decoding gets cheaper, 0 to disable")
+      ("stream", po::value<bool>()->default_value(false), "Enable/disable sliding window streaming mode")
+      ("step_ms", po::value<int>()->default_value(500), "Streaming step in ms")
+      ("window_ms", po::value<int>()->default_value(5000), "Streaming window length in ms")
+      ("keep_ms", po::value<int>()->default_value(200), "Streaming window overlap in ms")
+      ("metrics_port", po::value<int>()->default_value(0), "Prometheus metrics port on loopback, 0 to disable")
+      ("trace_file", po::value<std::string>()->default_value(""), "Chrome trace JSON written on SIGUSR1 and at exit, empty to disable tracing")
+      ("control_socket", po::value<std::string>()->default_value(""), "UNIX socket path of the runtime control commands, empty to disable")
       ( "log_level,d", po::value<int>()->default_value(2), "Log levelfrom 0=trace to 5=fatal")
       ("help,h", "Print this help " "message");
   int unix_style = postyle::unix_style | postyle::short_allow_next;
@@ -87,13 +191,18 @@ int main(int argc, char *argv[]) {
 
   signal(SIGINT, termination_handler);
   signal(SIGTERM, termination_handler);
+  signal(SIGHUP, reload_handler);
+  signal(SIGUSR1, trace_handler);
   signal(SIGCHLD, SIG_IGN);
+  /* a sink reader going away is not fatal */
+  signal(SIGPIPE, SIG_IGN);
 
   std::srand(std::time(nullptr));
 
   Config config;
   config.set_device_name(vm["device_name"].as<std::string>());
   config.set_channels(vm["channels"].as<int>());
+  config.set_channel_groups(vm["channel_groups"].as<std::string>());
   config.set_log_severity(vm["log_level"].as<int>());
   config.set_sample_rate(vm["sample_rate"].as<int>());
   config.set_file_duration(vm["buffer_duration"].as<int>());
@@ -101,45 +210,207 @@ int main(int argc, char *argv[]) {
   config.set_silence_threshold(vm["silence_threshold"].as<float>());
   config.set_language(vm["language"].as<std::string>());
   config.set_model(vm["model"].as<std::string>());
+  config.set_draft_model(vm["draft_model"].as<std::string>());
+  config.set_draft_threads(vm["draft_threads"].as<int>());
   config.set_openvino_device(vm["openvino_device"].as<std::string>());
   config.set_vad_enabled(vm["vad_enabled"].as<bool>());
   config.set_vad_model(vm["vad_model"].as<std::string>());
   config.set_vad_threshold(vm["vad_threshold"].as<float>());
   config.set_use_context(vm["use_context"].as<bool>());
+  config.set_use_mmap(vm["use_mmap"].as<bool>());
+  config.set_period_size(std::max(vm["period_size"].as<int>(), 0));
+  config.set_periods(std::max(vm["periods"].as<int>(), 0));
+  config.set_buffer_time_ms(std::max(vm["buffer_time_ms"].as<int>(), 0));
+  config.set_auto_tune(vm["auto_tune"].as<bool>());
+  config.set_paced(vm["paced"].as<bool>());
+  config.set_min_segment_ms(vm["min_segment_ms"].as<int>());
+  config.set_pause_ms(vm["pause_ms"].as<int>());
+  config.set_workers(vm["workers"].as<int>());
+  config.set_worker_threads(vm["worker_threads"].as<int>());
+  config.set_max_rtf(vm["max_rtf"].as<float>());
+  config.set_capture_threads(std::clamp(vm["capture_threads"].as<int>(), 0, 64));
+  config.set_capture_cpu(vm["capture_cpu"].as<int>());
+  config.set_capture_priority(
+      std::clamp(vm["capture_priority"].as<int>(), 0, 99));
+  config.set_inference_cpus(vm["inference_cpus"].as<std::string>());
+  config.set_stream(vm["stream"].as<bool>());
+  config.set_step_ms(vm["step_ms"].as<int>());
+  config.set_window_ms(vm["window_ms"].as<int>());
+  config.set_keep_ms(vm["keep_ms"].as<int>());
+  config.set_sinks(vm["sinks"].as<std::string>());
+  config.set_store_segments(vm["store_segments"].as<int>());
+  config.set_store_retention_s(vm["store_retention_s"].as<int>());
+  config.set_metrics_port(vm["metrics_port"].as<int>());
+  config.set_trace_file(vm["trace_file"].as<std::string>());
+  config.set_control_socket(vm["control_socket"].as<std::string>());
+
+  /* the global options are the defaults of every pipeline */
+  std::vector<Config> pipelines;
+  if (vm.count("pipeline")) {
+    for (const auto &spec : vm["pipeline"].as<std::vector<std::string>>()) {
+      Config pipeline = config;
+      if (!parse_pipeline(spec, pipeline)) {
+        return EXIT_FAILURE;
+      }
+      pipelines.push_back(pipeline);
+    }
+  } else {
+    pipelines.push_back(config);
+  }
 
   /* init logging */
   log_init(config);
+  Trace::enable(!config.get_trace_file().empty());
+  Trace::set_thread_name("main");
 
   BOOST_LOG_TRIVIAL(debug) << "main:: initializing ...";
   try {
-    auto transcriber = Transcriber::create(config);
-    if (!transcriber->init()) {
-      throw std::runtime_error(std::string("main:: Transcriber init failed"));
+    MetricsServer metrics;
+    if (config.get_metrics_port() &&
+        !metrics.start(config.get_metrics_port())) {
+      throw std::runtime_error(std::string("main:: metrics server failed"));
+    }
+
+    /* the model memory is allocated on the nodes of the inference CPUs */
+    if (!Topology::init(config, pipelines)) {
+      throw std::runtime_error(std::string("main:: topology init failed"));
+    }
+
+    /* model and inference workers are shared by all the pipelines */
+    Model model(config);
+    if (!model.init()) {
+      throw std::runtime_error(std::string("main:: model init failed"));
+    }
+    Scheduler scheduler;
+    /* with context a result is the prompt of the next buffer */
+    if (!scheduler.init(model, config.get_workers(),
+                        config.get_worker_threads(),
+                        config.get_use_context() || config.get_stream())) {
+      throw std::runtime_error(std::string("main:: scheduler init failed"));
+    }
+    scheduler.get_overload().init(config.get_max_rtf(),
+                                  scheduler.get_workers());
+
+    /* optional draft model with its own worker, decoding greedy */
+    std::unique_ptr<Model> draft_model;
+    std::unique_ptr<Scheduler> draft_scheduler;
+    if (!config.get_draft_model().empty()) {
+      draft_model = std::make_unique<Model>(config, config.get_draft_model());
+      if (!draft_model->init()) {
+        throw std::runtime_error(std::string("main:: draft model init failed"));
+      }
+      draft_scheduler = std::make_unique<Scheduler>();
+      if (!draft_scheduler->init(*draft_model, 1, config.get_draft_threads(),
+                                 config.get_use_context(),
+                                 Metrics::label("model", "draft"))) {
+        throw std::runtime_error(
+            std::string("main:: draft scheduler init failed"));
+      }
+      draft_scheduler->get_overload().init(config.get_max_rtf(), 1, 2,
+                                           Metrics::label("model", "draft"));
+    }
+
+    /* devices spread over the capture loops, outliving the pipelines */
+    std::vector<std::unique_ptr<CaptureLoop>> capture_loops;
+    for (int i = 0; i < config.get_capture_threads(); i++) {
+      capture_loops.push_back(std::make_unique<CaptureLoop>());
+      if (!capture_loops.back()->start(config,
+                                       "loop " + std::to_string(i))) {
+        throw std::runtime_error(std::string("main:: capture loop failed"));
+      }
+    }
+
+    std::vector<std::unique_ptr<Transcriber>> transcribers;
+    for (const auto &pipeline : pipelines) {
+      CaptureLoop *capture_loop =
+          capture_loops.empty()
+              ? nullptr
+              : capture_loops[transcribers.size() % capture_loops.size()]
+                    .get();
+      transcribers.push_back(std::make_unique<Transcriber>(
+          pipeline, model, scheduler, draft_model.get(),
+          draft_scheduler.get(), capture_loop));
+      if (!transcribers.back()->init()) {
+        throw std::runtime_error(
+            std::string("main:: Transcriber init failed"));
+      }
     }
 
     BOOST_LOG_TRIVIAL(debug) << "main:: init done, entering loop...";
 
-    if (!transcriber->start_capture()) {
-      throw std::runtime_error(
-          std::string("main:: Transcriber start capture failed"));
+    for (auto &transcriber : transcribers) {
+      if (!transcriber->start_capture()) {
+        throw std::runtime_error(
+            std::string("main:: Transcriber start capture failed"));
+      }
     }
 
-    while (!is_terminated()) {
-      std::this_thread::sleep_for(std::chrono::seconds(1));
+    /* settings changes and pause/resume while capturing */
+    ControlServer control;
+    if (!config.get_control_socket().empty()) {
+      std::vector<Transcriber *> controlled;
+      for (auto &transcriber : transcribers) {
+        controlled.push_back(transcriber.get());
+      }
+      if (!control.start(config.get_control_socket(), controlled)) {
+        throw std::runtime_error(std::string("main:: control server failed"));
+      }
     }
 
-    std::string text;
-    if (transcriber->get_text(text)) {
-      std::cout << "Transcription:\n" << text << std::endl;
+    /* run until terminated or until all the replayed sources are done */
+    auto is_done = [&transcribers]() {
+      return std::all_of(transcribers.begin(), transcribers.end(),
+                         [](auto &t) { return t->is_done(); });
+    };
+    std::future<bool> reloaded;
+    while (!is_terminated() && !is_done()) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(100));
+      if (dump_trace.exchange(false) && Trace::is_enabled()) {
+        Trace::dump(config.get_trace_file());
+      }
+      /* load the model files again in the background on SIGHUP */
+      if (reload.exchange(false)) {
+        if (reloaded.valid() && reloaded.wait_for(std::chrono::seconds(0)) !=
+                                    std::future_status::ready) {
+          BOOST_LOG_TRIVIAL(warning) << "main:: reload already running";
+          continue;
+        }
+        reloaded = std::async(std::launch::async,
+                              [&scheduler, &draft_scheduler]() {
+                                bool ok = scheduler.reload();
+                                if (draft_scheduler) {
+                                  ok = draft_scheduler->reload() && ok;
+                                }
+                                return ok;
+                              });
+      }
     }
-    if (!transcriber->stop_capture()) {
-      throw std::runtime_error(
-          std::string("main:: Transcriber stop capture failed"));
+    if (terminate_signal) {
+      BOOST_LOG_TRIVIAL(info) << "main:: got signal " << terminate_signal;
+    }
+    if (reloaded.valid()) {
+      reloaded.wait();
+    }
+    if (Trace::is_enabled()) {
+      Trace::dump(config.get_trace_file());
     }
 
-    if (!transcriber->terminate()) {
-      throw std::runtime_error(std::string("main:: terminate failed"));
+    control.stop();
+    for (auto &transcriber : transcribers) {
+      if (!transcriber->stop_capture()) {
+        throw std::runtime_error(
+            std::string("main:: Transcriber stop capture failed"));
+      }
+      if (!transcriber->terminate()) {
+        throw std::runtime_error(std::string("main:: terminate failed"));
+      }
+    }
+    if (draft_scheduler) {
+      draft_scheduler->terminate();
+      draft_model->terminate();
     }
+    scheduler.terminate();
+    model.terminate();
   } catch (std::exception &e) {
     BOOST_LOG_TRIVIAL(fatal) << "main:: fatal exception error: " << e.what();
     rc = EXIT_FAILURE;
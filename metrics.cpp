@@ -0,0 +1,234 @@
+//
+//  metrics.cpp
+//
+//  Copyright (c) 2019 2025 Andrea Bondavalli. All rights reserved.
+//
+//  This program is free software: you can redistribute it and/or modify
+//  it under the terms of the MIT license
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+//
+
+#include <algorithm>
+#include <arpa/inet.h>
+#include <cstring>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sstream>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "log.hpp"
+#include "metrics.hpp"
+
+Histogram::Histogram(const std::vector<double> &bounds)
+    : bounds_(bounds), buckets_(new std::atomic<uint64_t>[bounds.size() + 1]) {
+  for (size_t i = 0; i <= bounds_.size(); i++) {
+    buckets_[i] = 0;
+  }
+}
+
+void Histogram::observe(double value) {
+  size_t index = std::lower_bound(bounds_.begin(), bounds_.end(), value) -
+                 bounds_.begin();
+  buckets_[index].fetch_add(1, std::memory_order_relaxed);
+  count_.fetch_add(1, std::memory_order_relaxed);
+  double sum = sum_.load(std::memory_order_relaxed);
+  while (!sum_.compare_exchange_weak(sum, sum + value,
+                                     std::memory_order_relaxed)) {
+  }
+}
+
+Metrics &Metrics::get() {
+  static Metrics instance;
+  return instance;
+}
+
+std::string Metrics::label(const std::string &key, const std::string &value) {
+  std::string out = key + "=\"";
+  for (char c : value) {
+    if (c == '\\' || c == '"') {
+      out += '\\';
+      out += c;
+    } else if (c == '\n') {
+      out += "\\n";
+    } else {
+      out += c;
+    }
+  }
+  return out + "\"";
+}
+
+Metrics::Family &Metrics::family(const std::string &name,
+                                 const std::string &help,
+                                 const std::string &type) {
+  auto &family = families_[name];
+  if (family.type.empty()) {
+    family.help = help;
+    family.type = type;
+  }
+  return family;
+}
+
+Counter &Metrics::counter(const std::string &name, const std::string &help,
+                          const std::string &labels) {
+  std::unique_lock lock(mutex_);
+  auto &metric = family(name, help, "counter").counters[labels];
+  if (!metric) {
+    metric = std::make_unique<Counter>();
+  }
+  return *metric;
+}
+
+Gauge &Metrics::gauge(const std::string &name, const std::string &help,
+                      const std::string &labels) {
+  std::unique_lock lock(mutex_);
+  auto &metric = family(name, help, "gauge").gauges[labels];
+  if (!metric) {
+    metric = std::make_unique<Gauge>();
+  }
+  return *metric;
+}
+
+Histogram &Metrics::histogram(const std::string &name, const std::string &help,
+                              const std::vector<double> &bounds,
+                              const std::string &labels) {
+  std::unique_lock lock(mutex_);
+  auto &metric = family(name, help, "histogram").histograms[labels];
+  if (!metric) {
+    metric = std::make_unique<Histogram>(bounds);
+  }
+  return *metric;
+}
+
+std::string Metrics::to_prometheus() const {
+  std::ostringstream out;
+  auto braces = [](const std::string &labels) {
+    return labels.empty() ? std::string() : "{" + labels + "}";
+  };
+  std::unique_lock lock(mutex_);
+  for (const auto &[name, family] : families_) {
+    out << "# HELP " << name << " " << family.help << "\n";
+    out << "# TYPE " << name << " " << family.type << "\n";
+    for (const auto &[labels, counter] : family.counters) {
+      out << name << braces(labels) << " " << counter->get() << "\n";
+    }
+    for (const auto &[labels, gauge] : family.gauges) {
+      out << name << braces(labels) << " " << gauge->get() << "\n";
+    }
+    for (const auto &[labels, histogram] : family.histograms) {
+      std::string sep = labels.empty() ? "" : labels + ",";
+      uint64_t cumulative{0};
+      const auto &bounds = histogram->get_bounds();
+      for (size_t i = 0; i <= bounds.size(); i++) {
+        cumulative += histogram->get_bucket(i);
+        out << name << "_bucket{" << sep << "le=\"";
+        if (i < bounds.size()) {
+          out << bounds[i];
+        } else {
+          out << "+Inf";
+        }
+        out << "\"} " << cumulative << "\n";
+      }
+      out << name << "_sum" << braces(labels) << " " << histogram->get_sum()
+          << "\n";
+      out << name << "_count" << braces(labels) << " "
+          << histogram->get_count() << "\n";
+    }
+  }
+  return out.str();
+}
+
+bool MetricsServer::start(uint16_t port) {
+  fd_ = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (fd_ < 0) {
+    BOOST_LOG_TRIVIAL(error) << "metrics:: cannot create socket: "
+                             << std::strerror(errno);
+    return false;
+  }
+  int on{1};
+  setsockopt(fd_, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+
+  /* loopback only, the metrics are not meant to leave the host */
+  struct sockaddr_in addr;
+  std::memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(port);
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  if (bind(fd_, reinterpret_cast<struct sockaddr *>(&addr), sizeof(addr)) <
+          0 ||
+      listen(fd_, 4) < 0) {
+    BOOST_LOG_TRIVIAL(error) << "metrics:: cannot listen on port " << port
+                             << ": " << std::strerror(errno);
+    ::close(fd_);
+    fd_ = -1;
+    return false;
+  }
+
+  running_ = true;
+  thread_ = std::thread([this]() { serve(); });
+  BOOST_LOG_TRIVIAL(info) << "metrics:: serving on http://127.0.0.1:" << port
+                          << "/metrics";
+  return true;
+}
+
+void MetricsServer::stop() {
+  if (running_) {
+    running_ = false;
+    thread_.join();
+    ::close(fd_);
+    fd_ = -1;
+  }
+}
+
+void MetricsServer::serve() {
+  while (running_) {
+    struct pollfd pfd = {fd_, POLLIN, 0};
+    if (poll(&pfd, 1, 200) <= 0) {
+      continue;
+    }
+    int fd = accept4(fd_, nullptr, nullptr, SOCK_CLOEXEC);
+    if (fd < 0) {
+      continue;
+    }
+    reply(fd);
+    ::close(fd);
+  }
+}
+
+void MetricsServer::reply(int fd) {
+  /* the request line is all we need */
+  char request[1024];
+  struct pollfd pfd = {fd, POLLIN, 0};
+  ssize_t r = 0;
+  if (poll(&pfd, 1, 1000) > 0) {
+    r = read(fd, request, sizeof(request) - 1);
+  }
+  if (r <= 0) {
+    return;
+  }
+  request[r] = 0;
+
+  std::string status{"200 OK"};
+  std::string body;
+  if (!std::strncmp(request, "GET /metrics", 12)) {
+    body = Metrics::get().to_prometheus();
+  } else {
+    status = "404 Not Found";
+  }
+  std::string response = "HTTP/1.0 " + status +
+                         "\r\nContent-Type: text/plain; version=0.0.4\r\n"
+                         "Content-Length: " +
+                         std::to_string(body.size()) +
+                         "\r\nConnection: close\r\n\r\n" + body;
+  size_t done{0};
+  while (done < response.size()) {
+    ssize_t w = write(fd, response.data() + done, response.size() - done);
+    if (w <= 0) {
+      break;
+    }
+    done += w;
+  }
+}
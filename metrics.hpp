@@ -0,0 +1,126 @@
+//
+//  metrics.hpp
+//
+//  Copyright (c) 2019 2025 Andrea Bondavalli. All rights reserved.
+//
+//  This program is free software: you can redistribute it and/or modify
+//  it under the terms of the MIT license
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+//
+
+#ifndef _METRICS_HPP_
+#define _METRICS_HPP_
+
+#include <atomic>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+class Counter {
+public:
+  void add(uint64_t value = 1) {
+    value_.fetch_add(value, std::memory_order_relaxed);
+  }
+  uint64_t get() const { return value_.load(std::memory_order_relaxed); }
+
+private:
+  std::atomic<uint64_t> value_{0};
+};
+
+class Gauge {
+public:
+  void set(double value) { value_.store(value, std::memory_order_relaxed); }
+  double get() const { return value_.load(std::memory_order_relaxed); }
+
+private:
+  std::atomic<double> value_{0};
+};
+
+/* fixed buckets, each observation is a few relaxed atomic updates */
+class Histogram {
+public:
+  explicit Histogram(const std::vector<double> &bounds);
+
+  void observe(double value);
+
+  const std::vector<double> &get_bounds() const { return bounds_; }
+  /* observations in bucket index, the last one is +Inf */
+  uint64_t get_bucket(size_t index) const {
+    return buckets_[index].load(std::memory_order_relaxed);
+  }
+  uint64_t get_count() const { return count_.load(std::memory_order_relaxed); }
+  double get_sum() const { return sum_.load(std::memory_order_relaxed); }
+
+private:
+  const std::vector<double> bounds_;
+  std::unique_ptr<std::atomic<uint64_t>[]> buckets_;
+  std::atomic<uint64_t> count_{0};
+  std::atomic<double> sum_{0};
+};
+
+/*
+ * Process wide metrics registry.
+ * Metrics are registered once, by name and labels, when a component
+ * starts and then updated lock free through the returned reference.
+ * The registry is exported in Prometheus text format.
+ */
+class Metrics {
+public:
+  static Metrics &get();
+
+  Counter &counter(const std::string &name, const std::string &help,
+                   const std::string &labels = "");
+  Gauge &gauge(const std::string &name, const std::string &help,
+               const std::string &labels = "");
+  Histogram &histogram(const std::string &name, const std::string &help,
+                       const std::vector<double> &bounds,
+                       const std::string &labels = "");
+
+  std::string to_prometheus() const;
+
+  /* key="value" with the value escaped */
+  static std::string label(const std::string &key, const std::string &value);
+
+private:
+  Metrics() = default;
+
+  struct Family {
+    std::string help;
+    std::string type;
+    std::map<std::string, std::unique_ptr<Counter>> counters;
+    std::map<std::string, std::unique_ptr<Gauge>> gauges;
+    std::map<std::string, std::unique_ptr<Histogram>> histograms;
+  };
+  Family &family(const std::string &name, const std::string &help,
+                 const std::string &type);
+
+  mutable std::mutex mutex_;
+  std::map<std::string, Family> families_;
+};
+
+/* Prometheus scrape endpoint on a loopback HTTP port */
+class MetricsServer {
+public:
+  MetricsServer() = default;
+  MetricsServer(const MetricsServer &) = delete;
+  ~MetricsServer() { stop(); }
+
+  bool start(uint16_t port);
+  void stop();
+
+private:
+  void serve();
+  void reply(int fd);
+
+  int fd_{-1};
+  std::atomic_bool running_{false};
+  std::thread thread_;
+};
+
+#endif
@@ -0,0 +1,106 @@
+//
+//  model.cpp
+//
+//  Copyright (c) 2019 2025 Andrea Bondavalli. All rights reserved.
+//
+//  This program is free software: you can redistribute it and/or modify
+//  it under the terms of the MIT license
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+//
+
+#include <vector>
+
+#include "log.hpp"
+#include "model.hpp"
+#include "utils.hpp"
+
+static void whisper_no_log_callback(ggml_log_level level,
+                                    const char* text,
+                                    void* user_data) {}
+
+bool Model::init() {
+  if (ctx_) {
+    terminate();
+  }
+
+  TimeElapsed ts{"model:: init"};
+
+  if (config_.get_log_severity() > 1) {
+    whisper_log_set(whisper_no_log_callback, NULL);
+  }
+
+  ctx_ = load();
+  return ctx_ != nullptr;
+}
+
+struct whisper_context* Model::load() const {
+  struct whisper_context_params cparams = whisper_context_default_params();
+  cparams.use_gpu = true;
+  /* the weights are copied into the context, the file is not kept */
+  struct whisper_context* ctx =
+      whisper_init_from_file_with_params_no_state(path_.c_str(), cparams);
+  if (!ctx) {
+    BOOST_LOG_TRIVIAL(fatal)
+        << "model::whisper_init_from_file_with_params_no_state() failed for "
+        << path_;
+    return nullptr;
+  }
+  BOOST_LOG_TRIVIAL(info) << "model:: loaded " << path_;
+  return ctx;
+}
+
+bool Model::is_compatible(struct whisper_context* ctx) const {
+  struct whisper_context* current = ctx_;
+  return current && whisper_n_vocab(ctx) == whisper_n_vocab(current);
+}
+
+struct whisper_state* Model::create_state(struct whisper_context* ctx) const {
+  if (!ctx) {
+    return nullptr;
+  }
+  struct whisper_state* state = whisper_init_state(ctx);
+  if (!state) {
+    BOOST_LOG_TRIVIAL(fatal) << "model:: whisper_init_state() failed";
+    return nullptr;
+  }
+  /* the encoder path is derived from the model path */
+  whisper_ctx_init_openvino_encoder_with_state(
+      ctx, state, path_.c_str(), config_.get_openvino_device().c_str(),
+      nullptr);
+  return state;
+}
+
+bool Model::warm_up(struct whisper_context* ctx, struct whisper_state* state,
+                    int n_threads) const {
+  std::vector<float> silence(WHISPER_SAMPLE_RATE, 0.0f);
+  whisper_full_params wparams =
+      whisper_full_default_params(WHISPER_SAMPLING_BEAM_SEARCH);
+  wparams.n_threads = n_threads;
+  wparams.print_progress = false;
+  wparams.print_special = false;
+  wparams.print_realtime = false;
+  wparams.print_timestamps = false;
+  wparams.no_context = true;
+  wparams.single_segment = true;
+  wparams.max_tokens = 1;
+  /* English-only models take "en" too, nullptr would detect it */
+  wparams.language = "en";
+  if (whisper_full_with_state(ctx, state, wparams, silence.data(),
+                              silence.size()) != 0) {
+    BOOST_LOG_TRIVIAL(error) << "model:: warm up failed";
+    return false;
+  }
+  return true;
+}
+
+void Model::terminate() {
+  struct whisper_context* ctx = ctx_.exchange(nullptr);
+  if (ctx) {
+    BOOST_LOG_TRIVIAL(debug) << "model:: terminate";
+    whisper_print_timings(ctx);
+    whisper_free(ctx);
+  }
+}
@@ -0,0 +1,73 @@
+//
+//  model.hpp
+//
+//  Copyright (c) 2019 2025 Andrea Bondavalli. All rights reserved.
+//
+//  This program is free software: you can redistribute it and/or modify
+//  it under the terms of the MIT license
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+//
+
+#ifndef _MODEL_HPP_
+#define _MODEL_HPP_
+
+#include <atomic>
+#include <string>
+#include <whisper.h>
+
+#include "config.hpp"
+
+/*
+ * Whisper model weights loaded once without inference state.
+ * Every transcription stream creates its own whisper_state from it.
+ * A reload loads a second context next to the current one and swaps it
+ * in once the states of the old context are gone, see Scheduler::reload().
+ */
+class Model {
+public:
+  explicit Model(const Config &config)
+      : config_(config), path_(config.get_model()){};
+  /* another model with the same settings, e.g. the draft model */
+  Model(const Config &config, const std::string &path)
+      : config_(config), path_(path){};
+  Model(const Model &) = delete;
+  ~Model() { terminate(); }
+
+  bool init();
+  void terminate();
+
+  /* load the model file again, the current context is kept */
+  struct whisper_context *load() const;
+  /* install a loaded context, the previous one is returned to be freed
+     with whisper_free() once none of its states is in use */
+  struct whisper_context *swap(struct whisper_context *ctx) {
+    return ctx_.exchange(ctx);
+  }
+  /* a context with the same vocabulary can replace the current one */
+  bool is_compatible(struct whisper_context *ctx) const;
+
+  /* new inference state, freed with whisper_free_state() */
+  struct whisper_state *create_state() { return create_state(ctx_); }
+  struct whisper_state *create_state(struct whisper_context *ctx) const;
+  /* transcribe a second of silence to pay the first allocations and the
+     cold caches before the capture starts */
+  bool warm_up(struct whisper_context *ctx, struct whisper_state *state,
+               int n_threads) const;
+
+  struct whisper_context *get_context() const { return ctx_; }
+  const std::string &get_path() const { return path_; }
+  bool is_multilingual() const {
+    struct whisper_context *ctx = ctx_;
+    return ctx && whisper_is_multilingual(ctx);
+  }
+
+private:
+  const Config &config_;
+  const std::string path_;
+  std::atomic<struct whisper_context *> ctx_{nullptr};
+};
+
+#endif
@@ -0,0 +1,75 @@
+//
+//  overload.cpp
+//
+//  Copyright (c) 2019 2025 Andrea Bondavalli. All rights reserved.
+//
+//  This program is free software: you can redistribute it and/or modify
+//  it under the terms of the MIT license
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+//
+
+#include <algorithm>
+
+#include "overload.hpp"
+#include "log.hpp"
+
+void OverloadController::init(float max_rtf, size_t workers,
+                              size_t min_level, const std::string &labels) {
+  std::unique_lock lock(mutex_);
+  max_rtf_ = max_rtf;
+  workers_ = workers ? workers : 1;
+  min_level_ = std::min(min_level, levels_num - 1);
+  level_ = min_level_;
+  backlog_ = 0;
+  rtf_ = 0;
+  since_change_ = 0;
+  level_gauge_ = &Metrics::get().gauge(
+      "whisper_alsa_decode_level",
+      "Decoding level, 0 is the most accurate, higher is cheaper", labels);
+  changes_ = &Metrics::get().counter("whisper_alsa_decode_level_changes_total",
+                                     "Decoding level changes on load", labels);
+  level_gauge_->set(level_);
+}
+
+void OverloadController::update(double rtf) {
+  if (max_rtf_ <= 0) {
+    return;
+  }
+  std::unique_lock lock(mutex_);
+  /* smooth over a few buffers, the first one sets the average */
+  rtf_ = since_change_ || rtf_ > 0 ? rtf_ * 0.7 + rtf * 0.3 : rtf;
+  if (++since_change_ < hold) {
+    return;
+  }
+
+  size_t level = level_;
+  /* the workers decode buffers side by side, each of them can take up
+     to max_rtf of its own share of the audio */
+  double max_rtf = max_rtf_ * workers_;
+  /* a backlog of a job per worker is falling behind whatever the rtf */
+  bool behind = rtf_ > max_rtf || backlog_ > workers_;
+  bool headroom = rtf_ < max_rtf / 2 && backlog_ == 0;
+  if (behind && level + 1 < levels_num) {
+    level++;
+  } else if (headroom && level > min_level_) {
+    level--;
+  } else {
+    return;
+  }
+
+  if (level > level_) {
+    BOOST_LOG_TRIVIAL(warning)
+        << "overload:: rtf " << rtf_ << " backlog " << backlog_
+        << ", decoding with " << levels[level].name;
+  } else {
+    BOOST_LOG_TRIVIAL(info) << "overload:: rtf " << rtf_
+                            << ", decoding with " << levels[level].name;
+  }
+  level_ = level;
+  since_change_ = 0;
+  level_gauge_->set(level);
+  changes_->add();
+}
@@ -0,0 +1,84 @@
+//
+//  overload.hpp
+//
+//  Copyright (c) 2019 2025 Andrea Bondavalli. All rights reserved.
+//
+//  This program is free software: you can redistribute it and/or modify
+//  it under the terms of the MIT license
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+//
+
+#ifndef _OVERLOAD_HPP_
+#define _OVERLOAD_HPP_
+
+#include <atomic>
+#include <cstddef>
+#include <mutex>
+#include <string>
+
+#include "metrics.hpp"
+
+/* decoding settings, from the most accurate to the cheapest */
+struct DecodeLevel {
+  const char *name;
+  bool greedy;
+  int beam_size;
+  int best_of;
+  /* temperature fallback re-decodes a failed segment */
+  bool fallback;
+  bool token_timestamps;
+  /* encoder context fitted to the buffer instead of 30 s */
+  bool fit_audio_ctx;
+};
+
+/*
+ * Overload controller shared by the inference workers.
+ * The real time factor of every buffer, against max_rtf times the
+ * workers decoding in parallel, and the number of jobs waiting for a
+ * worker drive the decoding level: when transcription falls
+ * behind, decoding steps down to cheaper settings before the capture
+ * runs out of buffers, and steps back up once there is headroom again.
+ * Levels change at most once every hold buffers.
+ */
+class OverloadController {
+public:
+  constexpr static DecodeLevel levels[] = {
+      {"beam search", false, 5, 5, true, true, false},
+      {"narrow beam", false, 2, 2, true, true, false},
+      {"greedy", true, 1, 1, false, true, false},
+      {"greedy without token timestamps", true, 1, 1, false, false, false},
+      {"greedy with fitted audio context", true, 1, 1, false, false, true}};
+  constexpr static size_t levels_num = sizeof(levels) / sizeof(levels[0]);
+  constexpr static size_t hold = 3;
+
+  OverloadController() = default;
+  OverloadController(const OverloadController &) = delete;
+
+  /* step down above max_rtf per worker, 0 to always decode at min_level */
+  void init(float max_rtf, size_t workers, size_t min_level = 0,
+            const std::string &labels = "");
+  /* a worker transcribed a buffer */
+  void update(double rtf);
+  /* jobs waiting for a worker */
+  void set_backlog(size_t jobs) { backlog_ = jobs; }
+
+  const DecodeLevel &get_level() const { return levels[level_]; }
+  size_t get_level_index() const { return level_; }
+
+private:
+  float max_rtf_{0};
+  size_t workers_{1};
+  size_t min_level_{0};
+  std::atomic<size_t> level_{0};
+  std::atomic<size_t> backlog_{0};
+  std::mutex mutex_;
+  double rtf_{0};
+  size_t since_change_{0};
+  Gauge *level_gauge_{nullptr};
+  Counter *changes_{nullptr};
+};
+
+#endif
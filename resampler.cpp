@@ -0,0 +1,265 @@
+//
+//  resampler.cpp
+//
+//  Copyright (c) 2019 2025 Andrea Bondavalli. All rights reserved.
+//
+//  This program is free software: you can redistribute it and/or modify
+//  it under the terms of the MIT license
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+//
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <numeric>
+
+#include "resampler.hpp"
+
+#if defined(__SSE2__)
+#include <immintrin.h>
+#define AVX2_TARGET __attribute__((target("avx2,fma")))
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+namespace {
+
+constexpr size_t cache_line = 64;
+/* filter length in output samples, sets the transition band */
+constexpr double taps_per_output = 48;
+/* pass band edge as a fraction of the lower Nyquist */
+constexpr double cutoff = 0.9;
+constexpr double kaiser_beta = 8.6;
+
+float dot_scalar(const float *coefs, const float *in, size_t taps) {
+  float acc[4] = {0, 0, 0, 0};
+  for (size_t t = 0; t < taps; t += 4) {
+    for (size_t k = 0; k < 4; k++) {
+      acc[k] += coefs[t + k] * in[t + k];
+    }
+  }
+  return (acc[0] + acc[1]) + (acc[2] + acc[3]);
+}
+
+#if defined(__SSE2__)
+
+float dot_sse2(const float *coefs, const float *in, size_t taps) {
+  __m128 acc0 = _mm_setzero_ps();
+  __m128 acc1 = _mm_setzero_ps();
+  for (size_t t = 0; t < taps; t += 8) {
+    acc0 = _mm_add_ps(acc0, _mm_mul_ps(_mm_load_ps(coefs + t),
+                                       _mm_loadu_ps(in + t)));
+    acc1 = _mm_add_ps(acc1, _mm_mul_ps(_mm_load_ps(coefs + t + 4),
+                                       _mm_loadu_ps(in + t + 4)));
+  }
+  __m128 acc = _mm_add_ps(acc0, acc1);
+  acc = _mm_add_ps(acc, _mm_movehl_ps(acc, acc));
+  acc = _mm_add_ss(acc, _mm_shuffle_ps(acc, acc, 1));
+  return _mm_cvtss_f32(acc);
+}
+
+AVX2_TARGET float dot_avx2(const float *coefs, const float *in, size_t taps) {
+  __m256 acc0 = _mm256_setzero_ps();
+  __m256 acc1 = _mm256_setzero_ps();
+  size_t t = 0;
+  for (; t + 16 <= taps; t += 16) {
+    acc0 = _mm256_fmadd_ps(_mm256_load_ps(coefs + t), _mm256_loadu_ps(in + t),
+                           acc0);
+    acc1 = _mm256_fmadd_ps(_mm256_load_ps(coefs + t + 8),
+                           _mm256_loadu_ps(in + t + 8), acc1);
+  }
+  if (t < taps) {
+    acc0 = _mm256_fmadd_ps(_mm256_load_ps(coefs + t), _mm256_loadu_ps(in + t),
+                           acc0);
+  }
+  __m256 acc = _mm256_add_ps(acc0, acc1);
+  __m128 sum = _mm_add_ps(_mm256_castps256_ps128(acc),
+                          _mm256_extractf128_ps(acc, 1));
+  sum = _mm_add_ps(sum, _mm_movehl_ps(sum, sum));
+  sum = _mm_add_ss(sum, _mm_shuffle_ps(sum, sum, 1));
+  return _mm_cvtss_f32(sum);
+}
+
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+
+float dot_neon(const float *coefs, const float *in, size_t taps) {
+  float32x4_t acc0 = vdupq_n_f32(0);
+  float32x4_t acc1 = vdupq_n_f32(0);
+  for (size_t t = 0; t < taps; t += 8) {
+    acc0 = vfmaq_f32(acc0, vld1q_f32(coefs + t), vld1q_f32(in + t));
+    acc1 = vfmaq_f32(acc1, vld1q_f32(coefs + t + 4), vld1q_f32(in + t + 4));
+  }
+  return vaddvq_f32(vaddq_f32(acc0, acc1));
+}
+
+#endif
+
+/* zeroth order modified Bessel function of the first kind */
+double bessel_i0(double x) {
+  double sum{1}, term{1};
+  for (int k = 1; k < 50; k++) {
+    term *= (x / (2 * k)) * (x / (2 * k));
+    sum += term;
+    if (term < sum * 1e-12) {
+      break;
+    }
+  }
+  return sum;
+}
+
+size_t aligned_floats(size_t n) {
+  return (n * sizeof(float) + cache_line - 1) / cache_line * cache_line /
+         sizeof(float);
+}
+
+float *aligned_alloc_floats(size_t n) {
+  return static_cast<float *>(
+      std::aligned_alloc(cache_line, aligned_floats(n) * sizeof(float)));
+}
+
+} // namespace
+
+bool Resampler::is_supported(uint32_t in_rate, uint32_t out_rate) {
+  return in_rate && out_rate &&
+         out_rate / std::gcd(in_rate, out_rate) <= max_phases;
+}
+
+bool Resampler::init(uint32_t in_rate, uint32_t out_rate, size_t planes) {
+  phases_ = 0;
+  if (in_rate == out_rate) {
+    return true;
+  }
+  if (!is_supported(in_rate, out_rate) || planes == 0) {
+    return false;
+  }
+  uint32_t g = std::gcd(in_rate, out_rate);
+  size_t phases = out_rate / g;
+  size_t step = in_rate / g;
+
+  /* filter length in input samples, a multiple of 8 for the kernels */
+  double ratio = static_cast<double>(step) / phases;
+  size_t taps = static_cast<size_t>(
+      std::ceil(taps_per_output * std::max(1.0, ratio) / 8) * 8);
+  coefs_.reset(aligned_alloc_floats(phases * taps));
+  if (!coefs_) {
+    return false;
+  }
+
+  /* the window ending at input sample i gives the output at i - taps/2
+     + phase/phases, arg is the distance of each tap from that time */
+  double fc = 0.5 * cutoff * std::min(1.0, 1.0 / ratio);
+  double half = taps / 2.0;
+  double i0_beta = bessel_i0(kaiser_beta);
+  for (size_t p = 0; p < phases; p++) {
+    float *c = coefs_.get() + p * taps;
+    double sum{0};
+    for (size_t j = 0; j < taps; j++) {
+      double arg = static_cast<double>(p) / phases + half - 1 -
+                   static_cast<double>(j);
+      double x = 2 * fc * arg;
+      double sinc = x == 0 ? 1 : std::sin(M_PI * x) / (M_PI * x);
+      double r = arg / half;
+      double window =
+          r * r < 1 ? bessel_i0(kaiser_beta * std::sqrt(1 - r * r)) / i0_beta
+                    : 0;
+      c[j] = 2 * fc * sinc * window;
+      sum += c[j];
+    }
+    /* unity gain at DC for every phase */
+    for (size_t j = 0; j < taps; j++) {
+      c[j] /= sum;
+    }
+  }
+
+  stride_ = aligned_floats(taps + block_frames);
+  buffer_.reset(aligned_alloc_floats(stride_ * planes));
+  if (!buffer_) {
+    return false;
+  }
+  input_.assign(planes, nullptr);
+
+  dot_ = dot_scalar;
+  name_ = "scalar";
+#if defined(__SSE2__)
+  if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) {
+    dot_ = dot_avx2;
+    name_ = "avx2";
+  } else {
+    dot_ = dot_sse2;
+    name_ = "sse2";
+  }
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+  dot_ = dot_neon;
+  name_ = "neon";
+#endif
+
+  phases_ = phases;
+  step_ = step;
+  taps_ = taps;
+  reset();
+  return true;
+}
+
+void Resampler::reset() {
+  std::memset(buffer_.get(), 0, stride_ * input_.size() * sizeof(float));
+  /* the first input sample ends the first window */
+  fill_ = taps_ - 1;
+  index_ = taps_ - 1;
+  phase_ = 0;
+  update_input();
+}
+
+void Resampler::update_input() {
+  for (size_t p = 0; p < input_.size(); p++) {
+    input_[p] = buffer_.get() + p * stride_ + fill_;
+  }
+}
+
+size_t Resampler::get_input_frames(size_t out_frames) const {
+  if (out_frames == 0) {
+    return 0;
+  }
+  /* sample ending the window of the last output frame, windows left
+     over by a capped process() need no input */
+  size_t last = index_ + (phase_ + (out_frames - 1) * step_) / phases_;
+  return last >= fill_ ? last + 1 - fill_ : 0;
+}
+
+size_t Resampler::process(size_t frames, float *const *out,
+                          size_t max_out) {
+  fill_ += frames;
+  size_t produced{0};
+  size_t index{index_}, phase{phase_};
+  for (size_t p = 0; p < input_.size(); p++) {
+    const float *in = buffer_.get() + p * stride_;
+    float *o = out[p];
+    index = index_;
+    phase = phase_;
+    produced = 0;
+    while (index < fill_ && produced < max_out) {
+      o[produced++] = dot_(coefs_.get() + phase * taps_,
+                           in + index + 1 - taps_, taps_);
+      phase += step_;
+      index += phase / phases_;
+      phase %= phases_;
+    }
+  }
+  index_ = index;
+  phase_ = phase;
+
+  /* keep the history of the next window */
+  size_t start = index_ + 1 - taps_;
+  if (start > 0) {
+    for (size_t p = 0; p < input_.size(); p++) {
+      float *buffer = buffer_.get() + p * stride_;
+      std::memmove(buffer, buffer + start, (fill_ - start) * sizeof(float));
+    }
+    fill_ -= start;
+    index_ -= start;
+  }
+  update_input();
+  return produced;
+}
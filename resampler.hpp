@@ -0,0 +1,90 @@
+//
+//  resampler.hpp
+//
+//  Copyright (c) 2019 2025 Andrea Bondavalli. All rights reserved.
+//
+//  This program is free software: you can redistribute it and/or modify
+//  it under the terms of the MIT license
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+//
+
+#ifndef _RESAMPLER_HPP_
+#define _RESAMPLER_HPP_
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <limits>
+#include <memory>
+#include <vector>
+
+/* dot product of taps coefficients and samples, taps multiple of 8 */
+using dot_fn = float (*)(const float *coefs, const float *in, size_t taps);
+
+/*
+ * Streaming polyphase resampler for rational ratios (48000 to 16000 is
+ * 1/3, 44100 to 16000 is 160/441).
+ * A Kaiser windowed sinc low pass, cut below the lower Nyquist, is split
+ * in one phase per output position. The caller converts each block of
+ * input frames straight into get_input() and calls process(), so the
+ * samples are filtered while still in cache; the filter history is kept
+ * across blocks and the output has a constant delay of half the filter.
+ */
+class Resampler {
+public:
+  constexpr static size_t block_frames = 256;
+  constexpr static size_t max_phases = 1024;
+
+  Resampler() = default;
+  Resampler(const Resampler &) = delete;
+
+  /* a resampler between equal rates is not enabled */
+  bool init(uint32_t in_rate, uint32_t out_rate, size_t planes);
+  static bool is_supported(uint32_t in_rate, uint32_t out_rate);
+  /* clear the history, as at the start of the stream */
+  void reset();
+  bool is_enabled() const { return phases_ != 0; }
+
+  /* input frames to write to get exactly out_frames output frames */
+  size_t get_input_frames(size_t out_frames) const;
+  /* write position of each plane, room for block_frames frames */
+  float *const *get_input() { return input_.data(); }
+  /* filter frames written to get_input(), the output frames written,
+     at most max_out: when upsampling the last input frame can end more
+     windows than requested, they are produced by the next call */
+  size_t process(size_t frames, float *const *out,
+                 size_t max_out = std::numeric_limits<size_t>::max());
+
+  const char *get_name() const { return name_; }
+  size_t get_taps() const { return taps_; }
+  size_t get_phases() const { return phases_; }
+
+private:
+  struct Deleter {
+    void operator()(float *p) const { std::free(p); }
+  };
+
+  void update_input();
+
+  dot_fn dot_{nullptr};
+  const char *name_{"none"};
+  /* output is phases_ / step_ times the input */
+  size_t phases_{0};
+  size_t step_{0};
+  size_t taps_{0};
+  /* phases_ x taps_ coefficients, taps in time order */
+  std::unique_ptr<float[], Deleter> coefs_;
+  /* per plane history and new input */
+  size_t stride_{0};
+  std::unique_ptr<float[], Deleter> buffer_;
+  std::vector<float *> input_;
+  /* samples in the buffers, last sample of the next window and phase */
+  size_t fill_{0};
+  size_t index_{0};
+  size_t phase_{0};
+};
+
+#endif
@@ -0,0 +1,97 @@
+//
+//  ring.cpp
+//
+//  Copyright (c) 2019 2025 Andrea Bondavalli. All rights reserved.
+//
+//  This program is free software: you can redistribute it and/or modify
+//  it under the terms of the MIT license
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+//
+
+#include <cerrno>
+#include <ctime>
+
+#include "ring.hpp"
+
+AudioRing::AudioRing() { sem_init(&ready_, 0, 0); }
+
+AudioRing::~AudioRing() { sem_destroy(&ready_); }
+
+bool AudioRing::init(size_t blocks, size_t block_samples, size_t planes) {
+  if (blocks < 2 || block_samples == 0 || planes == 0 || planes > 64) {
+    return false;
+  }
+
+  /* every plane starts on its own cache line */
+  size_t stride = (block_samples * sizeof(float) + cache_line - 1) /
+                  cache_line * cache_line;
+  arena_.reset(static_cast<float *>(
+      std::aligned_alloc(cache_line, stride * planes * blocks)));
+  if (!arena_) {
+    return false;
+  }
+
+  blocks_.assign(blocks, Block{});
+  for (size_t i = 0; i < blocks; i++) {
+    blocks_[i].data = arena_.get() + i * planes * stride / sizeof(float);
+    blocks_[i].stride = stride / sizeof(float);
+  }
+  block_samples_ = block_samples;
+  planes_ = planes;
+  head_ = 0;
+  tail_ = 0;
+  while (sem_trywait(&ready_) == 0) {
+  }
+  return true;
+}
+
+bool AudioRing::publish() {
+  uint64_t head = head_.load(std::memory_order_relaxed);
+  /* keep one block for the producer to write into */
+  if (head + 1 - tail_.load(std::memory_order_acquire) >= blocks_.size()) {
+    return false;
+  }
+  blocks_[head % blocks_.size()].id = head;
+  head_.store(head + 1, std::memory_order_release);
+  sem_post(&ready_);
+  return true;
+}
+
+bool AudioRing::wait(std::chrono::milliseconds timeout) {
+  /* a monotonic deadline, a wall clock step doesn't stretch the wait */
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  auto nsec = ts.tv_nsec + timeout.count() * 1000000;
+  ts.tv_sec += nsec / 1000000000;
+  ts.tv_nsec = nsec % 1000000000;
+  while (sem_clockwait(&ready_, CLOCK_MONOTONIC, &ts) < 0) {
+    if (errno != EINTR) {
+      return false;
+    }
+  }
+  return true;
+}
+
+AudioRing::Block *AudioRing::front() {
+  uint64_t tail = tail_.load(std::memory_order_relaxed);
+  if (tail == head_.load(std::memory_order_acquire)) {
+    return nullptr;
+  }
+  return &blocks_[tail % blocks_.size()];
+}
+
+AudioRing::Block *AudioRing::get(uint64_t id) {
+  if (id < tail_.load(std::memory_order_acquire) ||
+      id >= head_.load(std::memory_order_acquire)) {
+    return nullptr;
+  }
+  return &blocks_[id % blocks_.size()];
+}
+
+void AudioRing::pop() {
+  tail_.store(tail_.load(std::memory_order_relaxed) + 1,
+              std::memory_order_release);
+}
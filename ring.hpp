@@ -0,0 +1,96 @@
+//
+//  ring.hpp
+//
+//  Copyright (c) 2019 2025 Andrea Bondavalli. All rights reserved.
+//
+//  This program is free software: you can redistribute it and/or modify
+//  it under the terms of the MIT license
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+//
+
+#ifndef _RING_HPP_
+#define _RING_HPP_
+
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <memory>
+#include <semaphore.h>
+#include <vector>
+
+/*
+ * Single producer, single consumer ring of preallocated float blocks.
+ * The capture thread fills the block returned by producer_block() and
+ * hands it over with publish(), the transcription thread processes the
+ * block returned by front() in place and gives it back with pop().
+ * One block is always reserved to the producer, so at most blocks - 1
+ * are queued to the consumer. A block holds one plane of block_samples
+ * per channel group.
+ */
+class AudioRing {
+public:
+  static constexpr size_t cache_line = 64;
+
+  struct alignas(cache_line) Block {
+    float *data{nullptr};
+    /* distance between the planes in samples */
+    size_t stride{0};
+    /* samples to process starting at data + offset */
+    size_t offset{0};
+    size_t samples{0};
+    /* stream position of the first sample */
+    uint64_t position{0};
+    bool voiced{false};
+    /* planes with speech, bit per plane */
+    uint64_t voiced_planes{0};
+    uint64_t id{0};
+
+    float *plane(size_t index) const { return data + index * stride; }
+  };
+
+  AudioRing();
+  AudioRing(const AudioRing &) = delete;
+  ~AudioRing();
+
+  bool init(size_t blocks, size_t block_samples, size_t planes = 1);
+
+  size_t get_block_samples() const { return block_samples_; }
+  size_t get_planes() const { return planes_; }
+  size_t get_blocks() const { return blocks_.size(); }
+  size_t size() const {
+    return head_.load(std::memory_order_acquire) -
+           tail_.load(std::memory_order_acquire);
+  }
+
+  /* producer side, never blocks */
+  Block &producer_block() {
+    return blocks_[head_.load(std::memory_order_relaxed) % blocks_.size()];
+  }
+  /* id of the producer block once published */
+  uint64_t producer_id() const {
+    return head_.load(std::memory_order_relaxed);
+  }
+  /* hand the producer block over, its fields are set by the caller */
+  bool publish();
+
+  /* consumer side, calls can move between threads if serialized */
+  bool wait(std::chrono::milliseconds timeout);
+  Block *front();
+  /* queued block by id, nullptr if not published yet or already popped */
+  Block *get(uint64_t id);
+  void pop();
+
+private:
+  std::unique_ptr<float, decltype(&std::free)> arena_{nullptr, &std::free};
+  std::vector<Block> blocks_;
+  size_t block_samples_{0};
+  size_t planes_{1};
+  sem_t ready_;
+  alignas(cache_line) std::atomic<uint64_t> head_{0};
+  alignas(cache_line) std::atomic<uint64_t> tail_{0};
+};
+
+#endif
@@ -0,0 +1,339 @@
+//
+//  scheduler.cpp
+//
+//  Copyright (c) 2019 2025 Andrea Bondavalli. All rights reserved.
+//
+//  This program is free software: you can redistribute it and/or modify
+//  it under the terms of the MIT license
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+//
+
+#include <algorithm>
+
+#include "log.hpp"
+#include "scheduler.hpp"
+#include "topology.hpp"
+#include "utils.hpp"
+
+bool Scheduler::init(Model &model, size_t workers, size_t threads,
+                     bool serialize, const std::string &labels) {
+  terminate();
+
+  if (workers == 0) {
+    workers = 1;
+  }
+  if (threads == 0) {
+    /* the CPUs the workers inherit, see Topology */
+    size_t cores = std::max<size_t>(Topology::get_affinity().size(), 1);
+    if (cores > 1 && cores >= std::thread::hardware_concurrency()) {
+      /* dont't compete with the capture loop */
+      cores--;
+    }
+    threads = std::max<size_t>(cores / workers, 1);
+  }
+
+  model_ = &model;
+  workers_.assign(workers, Worker{});
+  for (size_t i = 0; i < workers; i++) {
+    workers_[i].id = i;
+    workers_[i].n_threads = threads;
+    workers_[i].overload = &overload_;
+    workers_[i].ctx = model.get_context();
+  }
+  std::vector<struct whisper_state *> states;
+  if (!create_states(model.get_context(), states)) {
+    BOOST_LOG_TRIVIAL(fatal) << "scheduler:: cannot create worker state";
+    workers_.clear();
+    return false;
+  }
+  for (size_t i = 0; i < workers; i++) {
+    workers_[i].state = states[i];
+  }
+
+  serialize_ = serialize;
+  serialized_.clear();
+  completing_.clear();
+  labels_ = labels;
+  stopping_ = false;
+  paused_ = false;
+  busy_ = 0;
+  queued_ = 0;
+  overload_.set_backlog(0);
+  jobs_gauge_ = &Metrics::get().gauge("whisper_alsa_scheduler_jobs",
+                                      "Inference jobs queued or running",
+                                      labels);
+  busy_gauge_ = &Metrics::get().gauge("whisper_alsa_scheduler_busy_workers",
+                                      "Workers running an inference job",
+                                      labels);
+  Metrics::get()
+      .gauge("whisper_alsa_scheduler_workers", "Inference workers", labels)
+      .set(workers);
+  for (auto &worker : workers_) {
+    threads_.emplace_back([this, &worker]() { worker_loop(worker); });
+  }
+  BOOST_LOG_TRIVIAL(info) << "scheduler:: " << workers << " workers with "
+                          << threads << " threads";
+  return true;
+}
+
+void Scheduler::terminate() {
+  if (!threads_.empty()) {
+    drain();
+    {
+      std::unique_lock lock(mutex_);
+      stopping_ = true;
+    }
+    job_cv_.notify_all();
+    for (auto &thread : threads_) {
+      thread.join();
+    }
+    threads_.clear();
+  }
+  for (auto &worker : workers_) {
+    if (worker.state) {
+      whisper_free_state(worker.state);
+    }
+  }
+  workers_.clear();
+}
+
+bool Scheduler::create_states(struct whisper_context *ctx,
+                              std::vector<struct whisper_state *> &states) {
+  TimeElapsed ts{"scheduler:: warm up"};
+  states.assign(workers_.size(), nullptr);
+  std::vector<std::thread> threads;
+  for (size_t i = 0; i < workers_.size(); i++) {
+    threads.emplace_back([this, ctx, &states, i]() {
+      states[i] = model_->create_state(ctx);
+      if (states[i]) {
+        model_->warm_up(ctx, states[i], workers_[i].n_threads);
+      }
+    });
+  }
+  for (auto &thread : threads) {
+    thread.join();
+  }
+  if (std::find(states.begin(), states.end(), nullptr) != states.end()) {
+    for (auto state : states) {
+      if (state) {
+        whisper_free_state(state);
+      }
+    }
+    return false;
+  }
+  return true;
+}
+
+bool Scheduler::reload() {
+  if (!model_ || workers_.empty()) {
+    return false;
+  }
+  BOOST_LOG_TRIVIAL(info) << "scheduler:: reloading " << model_->get_path();
+  struct whisper_context *ctx = model_->load();
+  if (!ctx) {
+    return false;
+  }
+  /* the streams keep prompt tokens of the current vocabulary */
+  if (!model_->is_compatible(ctx)) {
+    BOOST_LOG_TRIVIAL(error)
+        << "scheduler:: reloaded model has another vocabulary, ignored";
+    whisper_free(ctx);
+    return false;
+  }
+  std::vector<struct whisper_state *> states;
+  if (!create_states(ctx, states)) {
+    BOOST_LOG_TRIVIAL(error) << "scheduler:: cannot create worker state";
+    whisper_free(ctx);
+    return false;
+  }
+
+  /* the capture keeps filling the ring while the running jobs finish */
+  std::unique_lock lock(mutex_);
+  paused_ = true;
+  done_cv_.wait(lock, [this]() { return busy_ == 0; });
+  for (size_t i = 0; i < workers_.size(); i++) {
+    std::swap(workers_[i].state, states[i]);
+    workers_[i].ctx = ctx;
+  }
+  ctx = model_->swap(ctx);
+  paused_ = false;
+  lock.unlock();
+  job_cv_.notify_all();
+
+  for (auto state : states) {
+    whisper_free_state(state);
+  }
+  whisper_free(ctx);
+  BOOST_LOG_TRIVIAL(info) << "scheduler:: switched to the reloaded model";
+  return true;
+}
+
+size_t Scheduler::add_queue() {
+  std::unique_lock lock(mutex_);
+  return queues_++;
+}
+
+void Scheduler::submit(size_t queue, size_t stream, run_fn run,
+                       done_fn done) {
+  std::unique_lock lock(mutex_);
+  Job &job = jobs_[seq_++];
+  job.queue = queue;
+  job.stream = stream;
+  job.run = std::move(run);
+  job.done = std::move(done);
+  if (Trace::is_enabled()) {
+    job.submitted = Trace::clock::now();
+  }
+  jobs_gauge_->set(jobs_.size());
+  if (!job.run) {
+    job.state = State::finished;
+    complete(lock);
+  } else {
+    overload_.set_backlog(++queued_);
+    job_cv_.notify_one();
+  }
+}
+
+void Scheduler::drain(size_t queue) {
+  std::unique_lock lock(mutex_);
+  done_cv_.wait(lock, [this, queue]() { return !is_pending(queue); });
+}
+
+void Scheduler::drain() {
+  std::unique_lock lock(mutex_);
+  done_cv_.wait(lock, [this]() { return jobs_.empty(); });
+}
+
+bool Scheduler::is_pending(size_t queue) const {
+  for (const auto &[seq, job] : jobs_) {
+    if (job.queue == queue) {
+      return true;
+    }
+  }
+  return false;
+}
+
+void Scheduler::set_serialize(size_t queue, bool serialize) {
+  std::unique_lock lock(mutex_);
+  if (serialize) {
+    serialized_.insert(queue);
+  } else {
+    serialized_.erase(queue);
+    /* a queue may start overlapping jobs again */
+    job_cv_.notify_all();
+  }
+}
+
+size_t Scheduler::get_pending(size_t queue) const {
+  std::unique_lock lock(mutex_);
+  size_t pending{0};
+  for (const auto &[seq, job] : jobs_) {
+    pending += job.queue == queue;
+  }
+  return pending;
+}
+
+std::map<uint64_t, Scheduler::Job>::iterator Scheduler::next_job() {
+  if (paused_) {
+    return jobs_.end();
+  }
+  std::set<std::pair<size_t, size_t>> busy;
+  for (auto it = jobs_.begin(); it != jobs_.end(); ++it) {
+    Job &job = it->second;
+    auto stream = std::make_pair(job.queue, job.stream);
+    bool serialized = serialize_ || serialized_.count(job.queue);
+    if (job.state == State::queued &&
+        (!serialized || busy.find(stream) == busy.end())) {
+      return it;
+    }
+    /* an earlier job of the stream is not done yet */
+    busy.insert(stream);
+  }
+  return jobs_.end();
+}
+
+void Scheduler::complete(std::unique_lock<std::mutex> &lock) {
+  std::vector<std::pair<uint64_t, done_fn>> ready;
+  std::set<size_t> queues;
+  /* jobs of the queues taken may finish while the callbacks run */
+  while (true) {
+    /* queues with an earlier job not completed yet or completed by
+       another thread */
+    std::set<size_t> blocked;
+    for (auto &[seq, job] : jobs_) {
+      if (job.state != State::finished ||
+          blocked.find(job.queue) != blocked.end() ||
+          completing_.find(job.queue) != completing_.end()) {
+        blocked.insert(job.queue);
+        continue;
+      }
+      ready.emplace_back(seq, std::move(job.done));
+      queues.insert(job.queue);
+    }
+    if (ready.empty()) {
+      return;
+    }
+    completing_.insert(queues.begin(), queues.end());
+
+    lock.unlock();
+    for (auto &[seq, done] : ready) {
+      if (done) {
+        done();
+      }
+    }
+    lock.lock();
+
+    /* the jobs stay until done, a serialized stream waits for them */
+    for (const auto &[seq, done] : ready) {
+      jobs_.erase(seq);
+    }
+    for (auto queue : queues) {
+      completing_.erase(queue);
+    }
+    ready.clear();
+    queues.clear();
+    jobs_gauge_->set(jobs_.size());
+    /* a serialized stream may be free again */
+    job_cv_.notify_all();
+    done_cv_.notify_all();
+  }
+}
+
+void Scheduler::worker_loop(Worker &worker) {
+  BOOST_LOG_TRIVIAL(debug) << "scheduler:: worker " << worker.id << " start";
+  Trace::set_thread_name("worker " + std::to_string(worker.id) +
+                         (labels_.empty() ? "" : " " + labels_));
+  std::unique_lock lock(mutex_);
+  while (true) {
+    auto it = jobs_.end();
+    job_cv_.wait(lock, [this, &it]() {
+      it = next_job();
+      return stopping_ || it != jobs_.end();
+    });
+    if (it == jobs_.end()) {
+      break;
+    }
+
+    Job &job = it->second;
+    job.state = State::running;
+    overload_.set_backlog(--queued_);
+    if (Trace::is_enabled() && job.submitted != Trace::clock::time_point{}) {
+      Trace::add("queue_wait", job.submitted, Trace::clock::now(), it->first);
+    }
+    busy_gauge_->set(++busy_);
+    lock.unlock();
+    /* map nodes are stable, the job is only erased once finished */
+    job.run(worker);
+    lock.lock();
+    busy_gauge_->set(--busy_);
+    job.state = State::finished;
+    complete(lock);
+    if (paused_ && !busy_) {
+      done_cv_.notify_all();
+    }
+  }
+  BOOST_LOG_TRIVIAL(debug) << "scheduler:: worker " << worker.id << " end";
+}
@@ -0,0 +1,141 @@
+//
+//  scheduler.hpp
+//
+//  Copyright (c) 2019 2025 Andrea Bondavalli. All rights reserved.
+//
+//  This program is free software: you can redistribute it and/or modify
+//  it under the terms of the MIT license
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+//
+
+#ifndef _SCHEDULER_HPP_
+#define _SCHEDULER_HPP_
+
+#include <condition_variable>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <set>
+#include <thread>
+#include <vector>
+
+#include "metrics.hpp"
+#include "model.hpp"
+#include "overload.hpp"
+#include "trace.hpp"
+
+/* inference worker, owns a whisper_state and a thread budget */
+struct Worker {
+  size_t id{0};
+  int n_threads{1};
+  /* model context of the state, changes on reload */
+  struct whisper_context *ctx{nullptr};
+  struct whisper_state *state{nullptr};
+  /* decoding level shared by the pool */
+  OverloadController *overload{nullptr};
+};
+
+/*
+ * Pool of inference workers sharing one model.
+ * Jobs run on the first idle worker in submission order, their done
+ * callbacks are called in submission order within a queue once all the
+ * previous jobs of the queue completed, outside of the scheduler lock so
+ * they can submit jobs. Every capture pipeline has its own queue, so a
+ * slow pipeline doesn't hold back the results of others.
+ * With serialize set, for all the queues or for some of them, jobs of
+ * the same queue and stream never overlap: a job starts once the done
+ * callback of the previous one of its stream ran, so it can depend on
+ * its results (e.g. prompt tokens).
+ */
+class Scheduler {
+public:
+  using run_fn = std::function<void(Worker &worker)>;
+  using done_fn = std::function<void()>;
+
+  Scheduler() = default;
+  Scheduler(const Scheduler &) = delete;
+  ~Scheduler() { terminate(); }
+
+  /* start workers, threads is the per worker budget, 0 to split the
+     available cores among the workers, labels tell the metrics of
+     several pools apart */
+  bool init(Model &model, size_t workers, size_t threads, bool serialize,
+            const std::string &labels = "");
+  /* finish the queued jobs and stop the workers */
+  void terminate();
+  /* load the model file again and switch the workers over between two
+     jobs, the queued jobs wait for the switch */
+  bool reload();
+
+  /* new ordering queue */
+  size_t add_queue();
+  /* queue a job, a job without run is completed right away */
+  void submit(size_t queue, size_t stream, run_fn run, done_fn done);
+  /* wait for all the jobs of a queue to complete */
+  void drain(size_t queue);
+  /* wait for all the jobs to complete */
+  void drain();
+
+  /* serialize the streams of a queue from the next job on, see above,
+     the queues stay serialized when the pool was inited so */
+  void set_serialize(size_t queue, bool serialize);
+
+  size_t get_workers() const { return workers_.size(); }
+  size_t get_pending(size_t queue) const;
+  OverloadController &get_overload() { return overload_; }
+
+private:
+  enum class State { queued, running, finished };
+  struct Job {
+    size_t queue;
+    size_t stream;
+    run_fn run;
+    done_fn done;
+    State state{State::queued};
+    Trace::clock::time_point submitted;
+  };
+
+  void worker_loop(Worker &worker);
+  /* new warmed up state per worker, in parallel */
+  bool create_states(struct whisper_context *ctx,
+                     std::vector<struct whisper_state *> &states);
+  /* next job a worker can start, jobs_.end() if none */
+  std::map<uint64_t, Job>::iterator next_job();
+  /* call the done callbacks of the completed jobs in order, the lock is
+     released while they run */
+  void complete(std::unique_lock<std::mutex> &lock);
+  bool is_pending(size_t queue) const;
+
+  Model *model_{nullptr};
+  std::vector<Worker> workers_;
+  std::vector<std::thread> threads_;
+  /* metric labels, also in the worker thread names */
+  std::string labels_;
+  bool serialize_{false};
+  /* queues serialized since init */
+  std::set<size_t> serialized_;
+  bool stopping_{false};
+  /* no job starts while the workers switch model */
+  bool paused_{false};
+  uint64_t seq_{0};
+  size_t queues_{0};
+  /* queued, running and completed jobs not done yet by sequence */
+  std::map<uint64_t, Job> jobs_;
+  /* queues with done callbacks running, a queue is completed by one
+     thread at a time to keep the order */
+  std::set<size_t> completing_;
+  mutable std::mutex mutex_;
+  std::condition_variable job_cv_;
+  std::condition_variable done_cv_;
+  size_t busy_{0};
+  /* jobs waiting for a worker */
+  size_t queued_{0};
+  OverloadController overload_;
+  Gauge *jobs_gauge_{nullptr};
+  Gauge *busy_gauge_{nullptr};
+};
+
+#endif
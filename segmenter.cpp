@@ -0,0 +1,161 @@
+//
+//  segmenter.cpp
+//
+//  Copyright (c) 2019 2025 Andrea Bondavalli. All rights reserved.
+//
+//  This program is free software: you can redistribute it and/or modify
+//  it under the terms of the MIT license
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+//
+
+#include <algorithm>
+#include <cmath>
+
+#include "segmenter.hpp"
+#include "vad.hpp"
+
+void Segmenter::init(uint32_t rate, float threshold, size_t min_samples,
+                     size_t pause_samples, size_t planes, Vad *vad) {
+  energy_.assign(planes, 0);
+  vad_ = vad && vad->is_enabled() ? vad : nullptr;
+  vad_in_.assign(planes, nullptr);
+  analyzed_ = 0;
+  fed_ = 0;
+  length_ = 0;
+  if (vad_) {
+    vad_->reset();
+  }
+  frame_samples_ = rate * frame_ms / 1000;
+  pad_samples_ = rate * pad_ms / 1000;
+  min_samples_ = min_samples;
+  pause_samples_ = pause_samples;
+  threshold_ = threshold;
+  floor_ = threshold;
+  reset();
+}
+
+void Segmenter::reset(size_t cut) {
+  /* the vad skips them up to fed_ */
+  analyzed_ -= length_ - std::min(cut, length_);
+  std::fill(energy_.begin(), energy_.end(), 0);
+  count_ = 0;
+  length_ = 0;
+  speech_ = false;
+  speech_planes_ = 0;
+  begin_ = 0;
+  end_ = 0;
+  cut_ = 0;
+  quietest_ = 0;
+  quietest_rms_ = 0;
+}
+
+bool Segmenter::process(const float *const *in, size_t samples) {
+  /* samples past a cut are analyzed again in the next segment, the vad
+     sees them once */
+  if (vad_ && analyzed_ + samples > fed_) {
+    size_t skip = fed_ - analyzed_;
+    for (size_t p = 0; p < vad_in_.size(); p++) {
+      vad_in_[p] = in[p] + skip;
+    }
+    vad_->process(vad_in_.data(), vad_in_.size(), samples - skip);
+    fed_ = analyzed_ + samples;
+  }
+
+  size_t i = 0;
+  while (i < samples) {
+    size_t n = std::min(frame_samples_ - count_, samples - i);
+    for (size_t p = 0; p < energy_.size(); p++) {
+      float energy{0};
+      for (size_t k = 0; k < n; k++) {
+        energy += in[p][i + k] * in[p][i + k];
+      }
+      energy_[p] += energy;
+    }
+    count_ += n;
+    length_ += n;
+    analyzed_ += n;
+    i += n;
+
+    if (count_ == frame_samples_) {
+      bool pause = process_frame();
+      count_ = 0;
+      if (pause) {
+        cut_ = length_;
+        return true;
+      }
+    }
+  }
+  return false;
+}
+
+bool Segmenter::process_frame() {
+  float rms{0};
+  /* the accumulators are reused for the rms of the frame */
+  std::vector<float> &plane_rms = energy_;
+  for (size_t p = 0; p < energy_.size(); p++) {
+    plane_rms[p] = std::sqrt(energy_[p] / count_);
+    rms = std::max(rms, plane_rms[p]);
+  }
+
+  bool is_speech = vad_ ? vad_->is_speech(analyzed_ - 1)
+                        : rms > threshold_ && rms > floor_ * ratio;
+  for (size_t p = 0; p < energy_.size(); p++) {
+    /* the loudest plane carries the voice the vad detected */
+    bool voiced = plane_rms[p] > threshold_ && plane_rms[p] > floor_ * ratio;
+    if (is_speech && (voiced || (vad_ && plane_rms[p] == rms))) {
+      speech_planes_ |= uint64_t{1} << p;
+    }
+    energy_[p] = 0;
+  }
+
+  if (is_speech) {
+    if (!speech_) {
+      speech_ = true;
+      begin_ = length_ - frame_samples_;
+    }
+    end_ = length_;
+    /* let the floor follow a rising background slowly, at a capped rate
+       so that a long loud talk doesn't turn into noise */
+    floor_ = std::min(floor_ + (rms - floor_) * 0.002f,
+                      floor_ * speech_floor_rise);
+  } else {
+    /* track the floor quickly down and slowly up */
+    floor_ += (rms - floor_) * (rms < floor_ ? 0.2f : 0.05f);
+  }
+
+  if (length_ < min_samples_) {
+    return false;
+  }
+  if (!quietest_ || rms <= quietest_rms_) {
+    quietest_ = length_;
+    quietest_rms_ = rms;
+  }
+  /* first pause after the minimum length */
+  return speech_ && !is_speech && length_ - end_ >= pause_samples_;
+}
+
+void Segmenter::discard(size_t samples) {
+  if (speech_) {
+    return;
+  }
+  samples = std::min(samples, length_);
+  length_ -= samples;
+  quietest_ = 0;
+}
+
+size_t Segmenter::get_begin() const {
+  if (!speech_) {
+    return 0;
+  }
+  return begin_ > pad_samples_ ? begin_ - pad_samples_ : 0;
+}
+
+size_t Segmenter::get_end() const {
+  if (!speech_) {
+    return 0;
+  }
+  return std::min(end_ + pad_samples_, length_);
+}
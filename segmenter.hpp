@@ -0,0 +1,106 @@
+//
+//  segmenter.hpp
+//
+//  Copyright (c) 2019 2025 Andrea Bondavalli. All rights reserved.
+//
+//  This program is free software: you can redistribute it and/or modify
+//  it under the terms of the MIT license
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+//
+
+#ifndef _SEGMENTER_HPP_
+#define _SEGMENTER_HPP_
+
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+class Vad;
+
+/*
+ * Energy based speech segmentation of the captured audio.
+ * The audio is analyzed in frames of frame_ms: a frame is speech when
+ * its RMS is above both the configured threshold and the adaptive noise
+ * floor by ratio. A segment is closed at the first pause after the
+ * minimum length; positions are relative to the segment start.
+ * With several planes a frame is classified by its loudest plane and
+ * the planes with speech are tracked separately.
+ * With a Vad a frame is speech when the voice probability of its last
+ * sample is above the VAD threshold instead, the energy still picks the
+ * planes and the cuts.
+ */
+class Segmenter {
+public:
+  constexpr static uint16_t frame_ms = 20;
+  constexpr static uint16_t pad_ms = 200;
+  constexpr static float ratio = 3.0f;
+  /* most the floor rises in a speech frame, 1 dB a second */
+  constexpr static float speech_floor_rise = 1.0023f;
+
+  Segmenter() = default;
+  Segmenter(const Segmenter &) = delete;
+
+  /* vad, if any, classifies the frames, it is reset */
+  void init(uint32_t rate, float threshold, size_t min_samples,
+            size_t pause_samples, size_t planes = 1, Vad *vad = nullptr);
+  /* start a new segment at cut, the noise floor is kept and the samples
+     already analyzed past the cut are given again to process() */
+  void reset(size_t cut = std::numeric_limits<size_t>::max());
+  /* speech threshold from the next frame */
+  void set_threshold(float threshold) { threshold_ = threshold; }
+  /* analyze the next samples, true at the first pause after the minimum
+     length, in which case samples past get_cut() are not analyzed */
+  bool process(const float *in, size_t samples) {
+    return process(&in, samples);
+  }
+  bool process(const float *const *in, size_t samples);
+  /* forget the first samples of a segment without speech */
+  void discard(size_t samples);
+
+  bool has_speech() const { return speech_; }
+  /* planes with speech, bit per plane */
+  uint64_t get_speech_planes() const { return speech_planes_; }
+  size_t get_length() const { return length_; }
+  size_t get_cut() const { return cut_; }
+  /* speech boundaries including padding */
+  size_t get_begin() const;
+  size_t get_end() const;
+  /* end of the quietest frame after the minimum length */
+  size_t get_quietest() const { return quietest_ ? quietest_ : length_; }
+  size_t get_pad_samples() const { return pad_samples_; }
+  float get_noise_floor() const { return floor_; }
+
+private:
+  bool process_frame();
+
+  size_t frame_samples_{320};
+  size_t pad_samples_{3200};
+  size_t min_samples_{0};
+  size_t pause_samples_{0};
+  float threshold_{1e-3};
+  float floor_{1e-3};
+  Vad *vad_{nullptr};
+  std::vector<const float *> vad_in_;
+  /* samples analyzed and fed to the vad since init */
+  uint64_t analyzed_{0};
+  uint64_t fed_{0};
+
+  /* partial frame accumulator per plane */
+  std::vector<float> energy_{0};
+  size_t count_{0};
+
+  size_t length_{0};
+  bool speech_{false};
+  uint64_t speech_planes_{0};
+  size_t begin_{0};
+  size_t end_{0};
+  size_t cut_{0};
+  size_t quietest_{0};
+  float quietest_rms_{0};
+};
+
+#endif
@@ -0,0 +1,81 @@
+//
+//  settings.cpp
+//
+//  Copyright (c) 2019 2025 Andrea Bondavalli. All rights reserved.
+//
+//  This program is free software: you can redistribute it and/or modify
+//  it under the terms of the MIT license
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+//
+
+#include <sstream>
+
+#include "log.hpp"
+#include "settings.hpp"
+#include "whisper.h"
+
+void Settings::init(const Config &config) {
+  auto values = std::make_shared<Values>();
+  values->silence_threshold = config.get_silence_threshold();
+  values->vad_threshold = config.get_vad_threshold();
+  values->language = config.get_language();
+  values->use_context = config.get_use_context();
+  std::lock_guard<std::mutex> lock(mutex_);
+  publish(std::move(values));
+}
+
+static bool to_threshold(const std::string &value, float &out) {
+  try {
+    size_t pos;
+    out = std::stof(value, &pos);
+    return pos == value.size() && out >= 0 && out <= 1;
+  } catch (std::exception &) {
+    return false;
+  }
+}
+
+bool Settings::set(const std::string &key, const std::string &value,
+                   std::string &error) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto values = std::make_shared<Values>(*get());
+  if (key == "silence_threshold" || key == "vad_threshold") {
+    float threshold;
+    if (!to_threshold(value, threshold)) {
+      error = "invalid " + key + " " + value + ", expected 0 to 1";
+      return false;
+    }
+    (key == "silence_threshold" ? values->silence_threshold
+                                : values->vad_threshold) = threshold;
+  } else if (key == "language") {
+    if (value != "auto" && whisper_lang_id(value.c_str()) < 0) {
+      error = "unknown language " + value;
+      return false;
+    }
+    values->language = value;
+  } else if (key == "use_context") {
+    if (value != "0" && value != "1") {
+      error = "invalid use_context " + value + ", expected 0 or 1";
+      return false;
+    }
+    values->use_context = value == "1";
+  } else {
+    error = "unknown setting " + key;
+    return false;
+  }
+  publish(std::move(values));
+  BOOST_LOG_TRIVIAL(info) << "settings:: " << key << " set to " << value;
+  return true;
+}
+
+std::string Settings::to_string() const {
+  auto values = get();
+  std::ostringstream os;
+  os << "silence_threshold=" << values->silence_threshold
+     << " vad_threshold=" << values->vad_threshold
+     << " language=" << values->language
+     << " use_context=" << values->use_context;
+  return os.str();
+}
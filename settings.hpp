@@ -0,0 +1,64 @@
+//
+//  settings.hpp
+//
+//  Copyright (c) 2019 2025 Andrea Bondavalli. All rights reserved.
+//
+//  This program is free software: you can redistribute it and/or modify
+//  it under the terms of the MIT license
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+//
+
+#ifndef _SETTINGS_HPP_
+#define _SETTINGS_HPP_
+
+#include <memory>
+#include <mutex>
+#include <string>
+
+#include "config.hpp"
+
+/*
+ * Pipeline settings that can change while capturing.
+ * The values are an immutable snapshot replaced as a whole, RCU style:
+ * readers take the current snapshot once per buffer and keep using it
+ * to the end of the buffer, without locking, while a change publishes
+ * a modified copy. A buffer never sees half of a change.
+ */
+class Settings {
+public:
+  struct Values {
+    float silence_threshold{1e-3};
+    float vad_threshold{1e-1};
+    std::string language{"en"};
+    bool use_context{false};
+  };
+
+  Settings() = default;
+  Settings(const Settings &) = delete;
+
+  void init(const Config &config);
+
+  std::shared_ptr<const Values> get() const {
+    return std::atomic_load_explicit(&values_, std::memory_order_acquire);
+  }
+  /* change one setting by name, false with the reason in error */
+  bool set(const std::string &key, const std::string &value,
+           std::string &error);
+  /* key=value list of the current values */
+  std::string to_string() const;
+
+private:
+  void publish(std::shared_ptr<const Values> values) {
+    std::atomic_store_explicit(&values_, std::move(values),
+                               std::memory_order_release);
+  }
+
+  std::shared_ptr<const Values> values_{std::make_shared<Values>()};
+  /* serializes the writers */
+  std::mutex mutex_;
+};
+
+#endif
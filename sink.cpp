@@ -0,0 +1,279 @@
+//
+//  sink.cpp
+//
+//  Copyright (c) 2019 2025 Andrea Bondavalli. All rights reserved.
+//
+//  This program is free software: you can redistribute it and/or modify
+//  it under the terms of the MIT license
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+//
+
+#include <boost/algorithm/string.hpp>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <iostream>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "log.hpp"
+#include "sink.hpp"
+
+using namespace std::chrono_literals;
+
+std::unique_ptr<Sink> Sink::create(const std::string &spec) {
+  auto pos = spec.find(':');
+  std::string type = spec.substr(0, pos);
+  std::string path = pos == std::string::npos ? "" : spec.substr(pos + 1);
+  if (type == "stdout") {
+    return std::make_unique<StdoutSink>();
+  }
+  if (path.empty()) {
+    BOOST_LOG_TRIVIAL(fatal) << "sink:: invalid sink " << spec;
+    return nullptr;
+  }
+  if (type == "file" || type == "jsonl") {
+    return std::make_unique<FileSink>(path, type == "jsonl");
+  }
+  if (type == "unix" || type == "fifo") {
+    return std::make_unique<SocketSink>(path, type == "fifo");
+  }
+  BOOST_LOG_TRIVIAL(fatal) << "sink:: unknown sink " << spec;
+  return nullptr;
+}
+
+static std::string json_escape(const std::string &in) {
+  std::string out;
+  for (unsigned char c : in) {
+    switch (c) {
+    case '"':
+      out += "\\\"";
+      break;
+    case '\\':
+      out += "\\\\";
+      break;
+    case '\n':
+      out += "\\n";
+      break;
+    case '\r':
+      out += "\\r";
+      break;
+    case '\t':
+      out += "\\t";
+      break;
+    default:
+      if (c < 0x20) {
+        char buf[8];
+        std::snprintf(buf, sizeof(buf), "\\u%04x", c);
+        out += buf;
+      } else {
+        out += c;
+      }
+    }
+  }
+  return out;
+}
+
+std::string Sink::to_json(const TextSegment &segment) {
+  char probability[16];
+  std::snprintf(probability, sizeof(probability), "%.3f",
+                segment.probability);
+  return "{\"seq\":" + std::to_string(segment.seq) + ",\"pipeline\":\"" +
+         json_escape(segment.pipeline) +
+         "\",\"stream\":\"" + json_escape(segment.stream) +
+         "\",\"t0\":" + std::to_string(segment.t0) +
+         ",\"t1\":" + std::to_string(segment.t1) + ",\"text\":\"" +
+         json_escape(segment.text) + "\",\"probability\":" + probability +
+         ",\"partial\":" + (segment.partial ? "true" : "false") + "}\n";
+}
+
+void StdoutSink::write(const TextSegment &segment) {
+  if (segment.partial) {
+    return;
+  }
+  /* pipelines share stdout, write whole lines */
+  static std::mutex mutex;
+  std::string line;
+  if (!segment.pipeline.empty() || !segment.stream.empty()) {
+    line = "[" + segment.pipeline +
+           (segment.stream.empty() || segment.pipeline.empty() ? "" : " ") +
+           segment.stream + "] ";
+  }
+  line += segment.text + "\n";
+  std::unique_lock lock(mutex);
+  std::cout << line << std::flush;
+}
+
+bool FileSink::open() {
+  out_.open(path_, std::ios::out | std::ios::app);
+  if (!out_) {
+    BOOST_LOG_TRIVIAL(fatal) << "sink:: cannot open " << path_;
+    return false;
+  }
+  return true;
+}
+
+void FileSink::write(const TextSegment &segment) {
+  if (jsonl_) {
+    out_ << to_json(segment);
+  } else if (!segment.partial) {
+    out_ << segment.text << "\n";
+  } else {
+    return;
+  }
+  out_.flush();
+  if (!out_) {
+    BOOST_LOG_TRIVIAL(error) << "sink:: cannot write to " << path_;
+    out_.clear();
+  }
+}
+
+bool SocketSink::open() {
+  if (!fifo_ && path_.size() >= sizeof(sockaddr_un::sun_path)) {
+    BOOST_LOG_TRIVIAL(fatal) << "sink:: socket path too long " << path_;
+    return false;
+  }
+  /* the peer may show up later */
+  connect();
+  return true;
+}
+
+bool SocketSink::connect() {
+  auto now = std::chrono::steady_clock::now();
+  if (now < retry_) {
+    return false;
+  }
+  retry_ = now + 1s;
+
+  if (fifo_) {
+    /* fails with ENXIO until a reader opens the FIFO */
+    fd_ = ::open(path_.c_str(), O_WRONLY | O_NONBLOCK | O_CLOEXEC);
+  } else {
+    fd_ = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd_ >= 0) {
+      struct sockaddr_un addr;
+      std::memset(&addr, 0, sizeof(addr));
+      addr.sun_family = AF_UNIX;
+      std::strncpy(addr.sun_path, path_.c_str(), sizeof(addr.sun_path) - 1);
+      if (::connect(fd_, reinterpret_cast<struct sockaddr *>(&addr),
+                    sizeof(addr)) < 0) {
+        ::close(fd_);
+        fd_ = -1;
+      } else {
+        /* a full socket buffer drops segments instead of blocking */
+        fcntl(fd_, F_SETFL, fcntl(fd_, F_GETFL) | O_NONBLOCK);
+      }
+    }
+  }
+  if (fd_ < 0) {
+    BOOST_LOG_TRIVIAL(debug) << "sink:: no listener on " << path_ << ": "
+                             << std::strerror(errno);
+    return false;
+  }
+  BOOST_LOG_TRIVIAL(info) << "sink:: connected to " << path_;
+  return true;
+}
+
+void SocketSink::write(const TextSegment &segment) {
+  if (fd_ < 0 && !connect()) {
+    return;
+  }
+  std::string line = to_json(segment);
+  ssize_t w = fifo_ ? ::write(fd_, line.data(), line.size())
+                    : send(fd_, line.data(), line.size(), MSG_NOSIGNAL);
+  if (w == static_cast<ssize_t>(line.size())) {
+    return;
+  }
+  if (w < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+    BOOST_LOG_TRIVIAL(warning) << "sink:: " << path_ << " full, dropping";
+    return;
+  }
+  /* peer gone or partial line, start over with a new connection */
+  BOOST_LOG_TRIVIAL(warning) << "sink:: " << path_ << " disconnected";
+  close();
+}
+
+void SocketSink::close() {
+  if (fd_ >= 0) {
+    ::close(fd_);
+    fd_ = -1;
+  }
+}
+
+bool Output::open(const std::string &sinks, const std::string &pipeline) {
+  close();
+  std::vector<std::string> specs;
+  boost::split(specs, sinks, boost::is_any_of(","));
+  for (const auto &spec : specs) {
+    if (spec.empty()) {
+      continue;
+    }
+    auto sink = Sink::create(spec);
+    if (!sink || !sink->open()) {
+      close();
+      return false;
+    }
+    auto writer = std::make_unique<Writer>();
+    writer->sink = std::move(sink);
+    writer->dropped = &Metrics::get().counter(
+        "whisper_alsa_sink_dropped_total",
+        "Segments dropped by a sink not keeping up",
+        Metrics::label("pipeline", pipeline) + "," +
+            Metrics::label("sink", spec));
+    writer->thread = std::thread(writer_loop, std::ref(*writer));
+    writers_.push_back(std::move(writer));
+    BOOST_LOG_TRIVIAL(info) << "sink:: " << pipeline << " writing to "
+                            << spec;
+  }
+  return true;
+}
+
+void Output::push(TextSegment segment) {
+  store_.append(segment);
+  for (auto &writer : writers_) {
+    {
+      std::unique_lock lock(writer->mutex);
+      if (writer->queue.size() >= queue_size) {
+        writer->queue.pop_front();
+        writer->dropped->add();
+      }
+      writer->queue.push_back(segment);
+    }
+    writer->cv.notify_one();
+  }
+}
+
+void Output::close() {
+  for (auto &writer : writers_) {
+    {
+      std::unique_lock lock(writer->mutex);
+      writer->stopping = true;
+    }
+    writer->cv.notify_one();
+    writer->thread.join();
+    writer->sink->close();
+  }
+  writers_.clear();
+}
+
+void Output::writer_loop(Writer &writer) {
+  std::unique_lock lock(writer.mutex);
+  while (true) {
+    writer.cv.wait(lock, [&writer]() {
+      return writer.stopping || !writer.queue.empty();
+    });
+    if (writer.queue.empty()) {
+      break;
+    }
+    TextSegment segment = std::move(writer.queue.front());
+    writer.queue.pop_front();
+    lock.unlock();
+    writer.sink->write(segment);
+    lock.lock();
+  }
+}
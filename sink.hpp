@@ -0,0 +1,130 @@
+//
+//  sink.hpp
+//
+//  Copyright (c) 2019 2025 Andrea Bondavalli. All rights reserved.
+//
+//  This program is free software: you can redistribute it and/or modify
+//  it under the terms of the MIT license
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+//
+
+#ifndef _SINK_HPP_
+#define _SINK_HPP_
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "metrics.hpp"
+#include "store.hpp"
+
+/* output of the segments, write() runs on the sink writer thread only */
+class Sink {
+public:
+  virtual ~Sink() = default;
+
+  /* stdout, file:<path>, jsonl:<path>, unix:<path> or fifo:<path> */
+  static std::unique_ptr<Sink> create(const std::string &spec);
+
+  virtual bool open() = 0;
+  virtual void write(const TextSegment &segment) = 0;
+  virtual void close() {}
+
+  static std::string to_json(const TextSegment &segment);
+};
+
+/* plain text lines on stdout, final segments only */
+class StdoutSink : public Sink {
+public:
+  bool open() override { return true; }
+  void write(const TextSegment &segment) override;
+};
+
+/* plain text lines appended to a file, or JSON lines with jsonl set */
+class FileSink : public Sink {
+public:
+  FileSink(const std::string &path, bool jsonl) : path_(path), jsonl_(jsonl){};
+
+  bool open() override;
+  void write(const TextSegment &segment) override;
+  void close() override { out_.close(); }
+
+private:
+  const std::string path_;
+  const bool jsonl_;
+  std::ofstream out_;
+};
+
+/*
+ * JSON lines to a UNIX domain stream socket or to a FIFO.
+ * The peer can come and go: segments are dropped while nobody is
+ * listening and the connection is retried at most once per second.
+ */
+class SocketSink : public Sink {
+public:
+  SocketSink(const std::string &path, bool fifo) : path_(path), fifo_(fifo){};
+  ~SocketSink() override { close(); }
+
+  bool open() override;
+  void write(const TextSegment &segment) override;
+  void close() override;
+
+private:
+  bool connect();
+
+  const std::string path_;
+  const bool fifo_;
+  int fd_{-1};
+  std::chrono::steady_clock::time_point retry_;
+};
+
+/*
+ * Sinks of a pipeline, each behind a bounded queue drained by its own
+ * writer thread: push() never waits for a sink, when a sink can't keep
+ * up its oldest queued segments are dropped.
+ * Segments are numbered and kept in the transcript store first.
+ */
+class Output {
+public:
+  constexpr static size_t queue_size = 1024;
+
+  Output() = default;
+  Output(const Output &) = delete;
+  ~Output() { close(); }
+
+  /* comma separated list of sink specs */
+  bool open(const std::string &sinks, const std::string &pipeline);
+  void push(TextSegment segment);
+  /* write the queued segments and stop the writers */
+  void close();
+
+  SegmentStore &get_store() { return store_; }
+  const SegmentStore &get_store() const { return store_; }
+
+private:
+  struct Writer {
+    std::unique_ptr<Sink> sink;
+    std::deque<TextSegment> queue;
+    std::mutex mutex;
+    std::condition_variable cv;
+    bool stopping{false};
+    Counter *dropped{nullptr};
+    std::thread thread;
+  };
+  static void writer_loop(Writer &writer);
+
+  std::vector<std::unique_ptr<Writer>> writers_;
+  SegmentStore store_;
+};
+
+#endif
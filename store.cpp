@@ -0,0 +1,84 @@
+//
+//  store.cpp
+//
+//  Copyright (c) 2019 2025 Andrea Bondavalli. All rights reserved.
+//
+//  This program is free software: you can redistribute it and/or modify
+//  it under the terms of the MIT license
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+//
+
+#include <algorithm>
+#include <mutex>
+
+#include "store.hpp"
+
+void SegmentStore::init(size_t capacity, std::chrono::seconds retention) {
+  std::unique_lock lock(mutex_);
+  records_.assign(capacity, Record{});
+  retention_ = retention;
+  last_ = 0;
+}
+
+void SegmentStore::append(TextSegment &segment) {
+  /* partial streaming text is replaced by the final one */
+  if (segment.partial) {
+    return;
+  }
+  std::unique_lock lock(mutex_);
+  if (records_.empty()) {
+    return;
+  }
+  segment.seq = ++last_;
+  Record &record = records_[last_ % records_.size()];
+  record.time = clock::now();
+  record.segment = segment;
+}
+
+uint64_t SegmentStore::first_seq(clock::time_point now) const {
+  if (!last_) {
+    return 1;
+  }
+  uint64_t first = last_ >= records_.size() ? last_ - records_.size() + 1 : 1;
+  if (retention_.count()) {
+    /* records are in time order, find the first one retained */
+    uint64_t last = last_ + 1;
+    while (first < last) {
+      uint64_t mid = first + (last - first) / 2;
+      if (now - records_[mid % records_.size()].time > retention_) {
+        first = mid + 1;
+      } else {
+        last = mid;
+      }
+    }
+  }
+  return first;
+}
+
+size_t SegmentStore::get_segments_since(uint64_t seq,
+                                        std::vector<TextSegment> &out,
+                                        size_t max) const {
+  std::shared_lock lock(mutex_);
+  if (records_.empty()) {
+    return 0;
+  }
+  size_t added{0};
+  for (uint64_t i = std::max(seq + 1, first_seq(clock::now()));
+       i <= last_ && added < max; i++, added++) {
+    out.push_back(records_[i % records_.size()].segment);
+  }
+  return added;
+}
+
+uint64_t SegmentStore::get_last_seq() const {
+  std::shared_lock lock(mutex_);
+  return last_;
+}
+
+uint64_t SegmentStore::get_first_seq() const {
+  std::shared_lock lock(mutex_);
+  return first_seq(clock::now());
+}
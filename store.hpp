@@ -0,0 +1,80 @@
+//
+//  store.hpp
+//
+//  Copyright (c) 2019 2025 Andrea Bondavalli. All rights reserved.
+//
+//  This program is free software: you can redistribute it and/or modify
+//  it under the terms of the MIT license
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+//
+
+#ifndef _STORE_HPP_
+#define _STORE_HPP_
+
+#include <chrono>
+#include <cstdint>
+#include <shared_mutex>
+#include <string>
+#include <vector>
+
+/* transcribed text as soon as it is decoded */
+struct TextSegment {
+  /* sequence number in the pipeline transcript, 0 for partial text */
+  uint64_t seq{0};
+  std::string pipeline;
+  /* channel group label, empty without groups */
+  std::string stream;
+  /* ms from the start of the capture */
+  int64_t t0{0};
+  int64_t t1{0};
+  std::string text;
+  /* mean token probability */
+  float probability{0};
+  /* streaming text that can still change */
+  bool partial{false};
+};
+
+/*
+ * Recent transcript of a pipeline.
+ * A ring of capacity segments numbered from 1: readers keep the
+ * sequence number of the last segment they got and ask for the newer
+ * ones only, so polling costs the new segments whatever the length of
+ * the transcript. The oldest segments are overwritten, and with a
+ * retention set segments older than that are not returned either.
+ */
+class SegmentStore {
+public:
+  SegmentStore() = default;
+  SegmentStore(const SegmentStore &) = delete;
+
+  void init(size_t capacity, std::chrono::seconds retention);
+  /* number the segment and store it, partial segments are not stored */
+  void append(TextSegment &segment);
+  /* append to out up to max segments after seq, the number added */
+  size_t get_segments_since(uint64_t seq, std::vector<TextSegment> &out,
+                            size_t max = SIZE_MAX) const;
+  /* sequence number of the last segment, 0 if none */
+  uint64_t get_last_seq() const;
+  /* oldest segment still stored, a reader behind it lost segments */
+  uint64_t get_first_seq() const;
+  size_t get_capacity() const { return records_.size(); }
+
+private:
+  using clock = std::chrono::steady_clock;
+  struct Record {
+    clock::time_point time;
+    TextSegment segment;
+  };
+
+  uint64_t first_seq(clock::time_point now) const;
+
+  std::vector<Record> records_;
+  std::chrono::seconds retention_{0};
+  uint64_t last_{0};
+  mutable std::shared_mutex mutex_;
+};
+
+#endif
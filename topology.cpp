@@ -0,0 +1,208 @@
+//
+//  topology.cpp
+//
+//  Copyright (c) 2019 2025 Andrea Bondavalli. All rights reserved.
+//
+//  This program is free software: you can redistribute it and/or modify
+//  it under the terms of the MIT license
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+//
+
+#include <pthread.h>
+#include <sched.h>
+
+#include <algorithm>
+#include <boost/algorithm/string.hpp>
+#include <cstring>
+#include <fstream>
+
+#include "log.hpp"
+#include "topology.hpp"
+
+std::vector<int> &Topology::process_cpus() {
+  static std::vector<int> cpus;
+  return cpus;
+}
+
+bool Topology::parse_cpus(const std::string &list, std::vector<int> &cpus) {
+  cpus.clear();
+  std::vector<std::string> ranges;
+  boost::split(ranges, boost::trim_copy(list), boost::is_any_of(","));
+  for (const auto &range : ranges) {
+    if (range.empty()) {
+      continue;
+    }
+    try {
+      auto pos = range.find('-');
+      int first = std::stoi(range.substr(0, pos));
+      int last = pos == std::string::npos ? first
+                                          : std::stoi(range.substr(pos + 1));
+      if (first < 0 || last < first || last >= CPU_SETSIZE) {
+        return false;
+      }
+      for (int cpu = first; cpu <= last; cpu++) {
+        cpus.push_back(cpu);
+      }
+    } catch (...) {
+      return false;
+    }
+  }
+  std::sort(cpus.begin(), cpus.end());
+  cpus.erase(std::unique(cpus.begin(), cpus.end()), cpus.end());
+  return true;
+}
+
+std::string Topology::format_cpus(const std::vector<int> &cpus) {
+  std::string list;
+  for (size_t i = 0; i < cpus.size(); i++) {
+    size_t j = i;
+    while (j + 1 < cpus.size() && cpus[j + 1] == cpus[j] + 1) {
+      j++;
+    }
+    list += (list.empty() ? "" : ",") + std::to_string(cpus[i]);
+    if (j > i) {
+      list += "-" + std::to_string(cpus[j]);
+    }
+    i = j;
+  }
+  return list;
+}
+
+std::vector<int> Topology::get_affinity() {
+  std::vector<int> cpus;
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  if (pthread_getaffinity_np(pthread_self(), sizeof(set), &set) == 0) {
+    for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+      if (CPU_ISSET(cpu, &set)) {
+        cpus.push_back(cpu);
+      }
+    }
+  }
+  return cpus;
+}
+
+bool Topology::set_affinity(const std::vector<int> &cpus) {
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  for (int cpu : cpus) {
+    CPU_SET(cpu, &set);
+  }
+  int err = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+  if (err) {
+    BOOST_LOG_TRIVIAL(error) << "topology:: cannot run on CPUs "
+                             << format_cpus(cpus) << " : " << strerror(err);
+    return false;
+  }
+  return true;
+}
+
+bool Topology::set_realtime(int priority) {
+  struct sched_param param;
+  memset(&param, 0, sizeof(param));
+  param.sched_priority = std::clamp(priority, sched_get_priority_min(SCHED_FIFO),
+                                    sched_get_priority_max(SCHED_FIFO));
+  int err = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+  if (err) {
+    /* needs CAP_SYS_NICE or an rtprio limit */
+    BOOST_LOG_TRIVIAL(warning)
+        << "topology:: cannot set SCHED_FIFO priority " << priority << " : "
+        << strerror(err);
+    return false;
+  }
+  return true;
+}
+
+std::vector<int> Topology::get_nodes(const std::vector<int> &cpus) {
+  std::vector<int> nodes;
+  for (int node = 0; node < 1024; node++) {
+    std::ifstream file("/sys/devices/system/node/node" +
+                       std::to_string(node) + "/cpulist");
+    if (!file) {
+      /* node numbers can have holes after hot unplug, stop after a few */
+      if (node > 64) {
+        break;
+      }
+      continue;
+    }
+    std::string list;
+    std::getline(file, list);
+    std::vector<int> node_cpus;
+    if (!parse_cpus(list, node_cpus)) {
+      continue;
+    }
+    for (int cpu : cpus) {
+      if (std::binary_search(node_cpus.begin(), node_cpus.end(), cpu)) {
+        nodes.push_back(node);
+        break;
+      }
+    }
+  }
+  return nodes;
+}
+
+bool Topology::init(const Config &config,
+                    const std::vector<Config> &pipelines) {
+  /* the pipelines take the global capture CPU unless they set theirs */
+  std::vector<int> capture_cpus;
+  for (const auto &pipeline : pipelines) {
+    if (pipeline.get_capture_cpu() >= 0) {
+      capture_cpus.push_back(pipeline.get_capture_cpu());
+    }
+  }
+  std::sort(capture_cpus.begin(), capture_cpus.end());
+  capture_cpus.erase(std::unique(capture_cpus.begin(), capture_cpus.end()),
+                     capture_cpus.end());
+
+  std::vector<int> cpus;
+  if (!parse_cpus(config.get_inference_cpus(), cpus)) {
+    BOOST_LOG_TRIVIAL(fatal) << "topology:: invalid inference CPUs "
+                             << config.get_inference_cpus();
+    return false;
+  }
+  process_cpus() = get_affinity();
+  if (cpus.empty()) {
+    /* everything but the capture CPUs, keeping one at least */
+    cpus = process_cpus();
+    for (int capture_cpu : capture_cpus) {
+      if (cpus.size() > 1) {
+        cpus.erase(std::remove(cpus.begin(), cpus.end(), capture_cpu),
+                   cpus.end());
+      }
+    }
+  }
+  if (!set_affinity(cpus)) {
+    return false;
+  }
+
+  std::string capture = "any CPU";
+  if (!capture_cpus.empty()) {
+    capture = "CPUs " + format_cpus(capture_cpus);
+  }
+  if (config.get_capture_priority()) {
+    capture += " SCHED_FIFO " + std::to_string(config.get_capture_priority());
+  }
+  BOOST_LOG_TRIVIAL(info) << "topology:: inference on CPUs "
+                          << format_cpus(cpus) << " NUMA nodes "
+                          << format_cpus(get_nodes(cpus)) << ", capture on "
+                          << capture;
+  return true;
+}
+
+bool Topology::set_capture_thread(const Config &config) {
+  bool ok{true};
+  int cpu = config.get_capture_cpu();
+  if (cpu >= 0) {
+    ok = set_affinity({cpu});
+  } else if (!process_cpus().empty()) {
+    /* don't inherit the inference CPUs */
+    ok = set_affinity(process_cpus());
+  }
+  if (config.get_capture_priority()) {
+    ok = set_realtime(config.get_capture_priority()) && ok;
+  }
+  return ok;
+}
@@ -0,0 +1,56 @@
+//
+//  topology.hpp
+//
+//  Copyright (c) 2019 2025 Andrea Bondavalli. All rights reserved.
+//
+//  This program is free software: you can redistribute it and/or modify
+//  it under the terms of the MIT license
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+//
+
+#ifndef _TOPOLOGY_HPP_
+#define _TOPOLOGY_HPP_
+
+#include <string>
+#include <vector>
+
+#include "config.hpp"
+
+/*
+ * Thread placement of the process.
+ * The main thread is pinned to the inference CPUs before the model is
+ * loaded: the model memory is first touched there, so it's allocated on
+ * their NUMA nodes, and the inference workers and their ggml threads
+ * inherit the CPU set. The capture threads move to their own CPUs with
+ * real time priority, away from the inference threads.
+ */
+class Topology {
+public:
+  /* CPU list like 0-3,6 */
+  static bool parse_cpus(const std::string &list, std::vector<int> &cpus);
+  static std::string format_cpus(const std::vector<int> &cpus);
+
+  /* CPUs the calling thread can run on */
+  static std::vector<int> get_affinity();
+  static bool set_affinity(const std::vector<int> &cpus);
+  /* SCHED_FIFO priority of the calling thread */
+  static bool set_realtime(int priority);
+  /* NUMA nodes of the CPUs */
+  static std::vector<int> get_nodes(const std::vector<int> &cpus);
+
+  /* place the calling thread on the inference CPUs, away from the
+     capture CPUs of every pipeline, and report the topology, call before
+     loading the models */
+  static bool init(const Config &config, const std::vector<Config> &pipelines);
+  /* place the calling capture thread */
+  static bool set_capture_thread(const Config &config);
+
+private:
+  /* CPUs of the process before init */
+  static std::vector<int> &process_cpus();
+};
+
+#endif
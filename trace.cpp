@@ -0,0 +1,186 @@
+//
+//  trace.cpp
+//
+//  Copyright (c) 2019 2025 Andrea Bondavalli. All rights reserved.
+//
+//  This program is free software: you can redistribute it and/or modify
+//  it under the terms of the MIT license
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+//
+
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <cstring>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "log.hpp"
+#include "trace.hpp"
+
+std::atomic<bool> Trace::enabled_{false};
+
+namespace {
+struct Span {
+  int64_t begin;
+  int64_t end;
+  int64_t arg;
+  char name[Trace::name_size];
+};
+
+struct Ring {
+  /* thread names are changed and read under the registry mutex */
+  std::string name;
+  pid_t tid{0};
+  bool in_use{false};
+  /* spans recorded, the last capacity are in the ring */
+  std::atomic<uint64_t> count{0};
+  Span spans[Trace::capacity];
+};
+
+constexpr size_t max_rings = 64;
+std::mutex mutex;
+std::vector<std::unique_ptr<Ring>> rings;
+const Trace::clock::time_point epoch = Trace::clock::now();
+
+/* ring of the calling thread, given back to the registry on exit */
+struct ThreadRing {
+  ~ThreadRing() {
+    if (ring) {
+      std::unique_lock lock(mutex);
+      ring->in_use = false;
+    }
+  }
+
+  Ring *get() {
+    if (!ring) {
+      std::unique_lock lock(mutex);
+      /* the spans of exited threads are kept until there are many */
+      for (auto &free : rings) {
+        if (rings.size() >= max_rings && !free->in_use) {
+          ring = free.get();
+          break;
+        }
+      }
+      if (!ring) {
+        rings.push_back(std::make_unique<Ring>());
+        ring = rings.back().get();
+      }
+      ring->in_use = true;
+      ring->tid = syscall(SYS_gettid);
+      ring->name.clear();
+      ring->count = 0;
+    }
+    return ring;
+  }
+
+  Ring *ring{nullptr};
+};
+
+thread_local ThreadRing thread_ring;
+
+int64_t to_ns(Trace::clock::time_point time) {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(time - epoch)
+      .count();
+}
+
+std::string escape(const std::string &text) {
+  std::string out;
+  for (char c : text) {
+    if (c == '"' || c == '\\') {
+      out += '\\';
+    }
+    out += (static_cast<unsigned char>(c) < 0x20) ? ' ' : c;
+  }
+  return out;
+}
+}  // namespace
+
+void Trace::set_thread_name(const std::string &name) {
+  Ring *ring = thread_ring.get();
+  std::unique_lock lock(mutex);
+  ring->name = name;
+}
+
+void Trace::add(const char *name, clock::time_point begin,
+                clock::time_point end, int64_t arg) {
+  if (!is_enabled()) {
+    return;
+  }
+  Ring *ring = thread_ring.get();
+  uint64_t count = ring->count.load(std::memory_order_relaxed);
+  Span &span = ring->spans[count % capacity];
+  span.begin = to_ns(begin);
+  span.end = to_ns(end);
+  span.arg = arg;
+  strncpy(span.name, name, sizeof(span.name) - 1);
+  span.name[sizeof(span.name) - 1] = '\0';
+  ring->count.store(count + 1, std::memory_order_release);
+}
+
+bool Trace::dump(const std::string &path) {
+  std::ofstream file(path, std::ios::trunc);
+  if (!file) {
+    BOOST_LOG_TRIVIAL(error) << "trace:: cannot write " << path;
+    return false;
+  }
+
+  size_t spans_num{0};
+  pid_t pid = getpid();
+  file << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+  bool first{true};
+  std::vector<Span> spans(capacity);
+  std::unique_lock lock(mutex);
+  for (auto &ring : rings) {
+    if (!ring->in_use && !ring->count) {
+      continue;
+    }
+    if (!ring->name.empty()) {
+      file << (first ? "" : ",") << "\n{\"ph\":\"M\",\"name\":\"thread_name\","
+           << "\"pid\":" << pid << ",\"tid\":" << ring->tid
+           << ",\"args\":{\"name\":\"" << escape(ring->name) << "\"}}";
+      first = false;
+    }
+
+    /* copy first, the thread keeps recording */
+    uint64_t end = ring->count.load(std::memory_order_acquire);
+    uint64_t begin = end > capacity ? end - capacity : 0;
+    for (uint64_t i = begin; i < end; i++) {
+      spans[i - begin] = ring->spans[i % capacity];
+    }
+    uint64_t now = ring->count.load(std::memory_order_acquire);
+    /* spans overwritten while copying */
+    if (now > capacity && now - capacity > begin) {
+      begin = std::min(now - capacity, end);
+    }
+
+    for (uint64_t i = begin; i < end; i++) {
+      const Span &span = spans[i - (end > capacity ? end - capacity : 0)];
+      char line[256];
+      snprintf(line, sizeof(line),
+               "%s\n{\"ph\":\"X\",\"name\":\"%s\",\"pid\":%d,\"tid\":%d,"
+               "\"ts\":%.3f,\"dur\":%.3f",
+               first ? "" : ",", escape(span.name).c_str(), pid, ring->tid,
+               span.begin / 1e3, (span.end - span.begin) / 1e3);
+      file << line;
+      if (span.arg >= 0) {
+        file << ",\"args\":{\"id\":" << span.arg << "}";
+      }
+      file << "}";
+      first = false;
+      spans_num++;
+    }
+  }
+  lock.unlock();
+  file << "\n]}\n";
+  file.close();
+
+  BOOST_LOG_TRIVIAL(info) << "trace:: " << spans_num << " spans written to "
+                          << path;
+  return file.good();
+}
@@ -0,0 +1,74 @@
+//
+//  trace.hpp
+//
+//  Copyright (c) 2019 2025 Andrea Bondavalli. All rights reserved.
+//
+//  This program is free software: you can redistribute it and/or modify
+//  it under the terms of the MIT license
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+//
+
+#ifndef _TRACE_HPP_
+#define _TRACE_HPP_
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <string>
+
+/*
+ * Span tracing of the hot paths, dumped as Chrome trace event JSON
+ * (chrome://tracing, ui.perfetto.dev).
+ * Every thread records into its own ring of the last capacity spans,
+ * written by the thread only, so recording takes no lock. A dump copies
+ * the rings while they are written and skips the spans overwritten
+ * meanwhile. Recording is off until enabled.
+ */
+class Trace {
+public:
+  using clock = std::chrono::steady_clock;
+  constexpr static size_t capacity = 8192;
+  constexpr static size_t name_size = 40;
+
+  static void enable(bool enabled) { enabled_ = enabled; }
+  static bool is_enabled() {
+    return enabled_.load(std::memory_order_relaxed);
+  }
+  /* name of the calling thread in the dump */
+  static void set_thread_name(const std::string &name);
+  /* span of the calling thread, arg is shown as id (e.g. buffer id) */
+  static void add(const char *name, clock::time_point begin,
+                  clock::time_point end, int64_t arg = -1);
+  /* write the spans of all the threads */
+  static bool dump(const std::string &path);
+
+private:
+  static std::atomic<bool> enabled_;
+};
+
+/* span from construction to destruction, name must outlive it */
+class TraceSpan {
+public:
+  explicit TraceSpan(const char *name, int64_t arg = -1)
+      : name_(Trace::is_enabled() ? name : nullptr), arg_(arg) {
+    if (name_) {
+      begin_ = Trace::clock::now();
+    }
+  }
+  TraceSpan(const TraceSpan &) = delete;
+  ~TraceSpan() {
+    if (name_) {
+      Trace::add(name_, begin_, Trace::clock::now(), arg_);
+    }
+  }
+
+private:
+  const char *name_;
+  int64_t arg_;
+  Trace::clock::time_point begin_;
+};
+
+#endif
@@ -11,29 +11,85 @@
 //  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
 //
 
+#include <algorithm>
 #include <boost/algorithm/string.hpp>
 #include <cmath>
+#include <cstring>
+#include <sstream>
 
 #include "log.hpp"
+#include "topology.hpp"
+#include "trace.hpp"
 #include "transcriber.hpp"
 #include "utils.hpp"
 
 using namespace std::chrono_literals;
 
-std::shared_ptr<Transcriber> Transcriber::create(const Config &config) {
-  // no need to be thread-safe here
-  static std::weak_ptr<Transcriber> instance;
-  if (auto ptr = instance.lock()) {
-    return ptr;
+bool Transcriber::init() {
+  BOOST_LOG_TRIVIAL(info) << "transcriber:: init " << get_name();
+  running_ = false;
+  settings_.init(config_);
+  queue_ = scheduler_.add_queue();
+  if (draft_scheduler_) {
+    draft_queue_ = draft_scheduler_->add_queue();
   }
-  auto ptr = std::shared_ptr<Transcriber>(new Transcriber(config));
-  instance = ptr;
-  return ptr;
+  return true;
 }
 
-bool Transcriber::init() {
-  BOOST_LOG_TRIVIAL(info) << "transcriber:: init";
-  running_ = false;
+const std::string &Transcriber::get_name() const {
+  return config_.get_pipeline_name().empty() ? config_.get_device_name()
+                                             : config_.get_pipeline_name();
+}
+
+bool Transcriber::parse_channel_groups() {
+  groups_.clear();
+  group_labels_.clear();
+  const std::string &spec = config_.get_channel_groups();
+  if (spec.empty()) {
+    group_labels_.push_back("");
+    return true;
+  }
+
+  std::vector<std::string> groups;
+  if (spec == "each") {
+    for (int ch = 0; ch < channels_; ch++) {
+      groups.push_back(std::to_string(ch));
+    }
+  } else {
+    boost::split(groups, spec, boost::is_any_of(","));
+  }
+  if (groups.size() > 64) {
+    BOOST_LOG_TRIVIAL(fatal) << "transcriber:: too many channel groups";
+    return false;
+  }
+
+  groups_.assign(channels_, UINT8_MAX);
+  for (size_t g = 0; g < groups.size(); g++) {
+    std::vector<std::string> channels;
+    boost::split(channels, groups[g], boost::is_any_of("+"));
+    for (const auto &channel : channels) {
+      int ch;
+      try {
+        ch = std::stoi(channel);
+      } catch (...) {
+        ch = -1;
+      }
+      if (ch < 0 || ch >= channels_ || groups_[ch] != UINT8_MAX) {
+        BOOST_LOG_TRIVIAL(fatal) << "transcriber:: invalid channel ["
+                                 << channel << "] in channel groups";
+        return false;
+      }
+      groups_[ch] = g;
+    }
+    group_labels_.push_back("ch " + groups[g]);
+  }
+  for (int ch = 0; ch < channels_; ch++) {
+    if (groups_[ch] == UINT8_MAX) {
+      BOOST_LOG_TRIVIAL(fatal)
+          << "transcriber:: channel " << ch << " not in any channel group";
+      return false;
+    }
+  }
   return true;
 }
 
@@ -47,6 +103,7 @@ bool Transcriber::start_capture() {
   files_num_ = config_.get_files_num();
   file_duration_ = config_.get_file_duration();
   silence_threshold_ = config_.get_silence_threshold();
+  stream_ = config_.get_stream();
 
   if (files_num_ < 3 || files_num_ > 10) {
     BOOST_LOG_TRIVIAL(info) << "transcriber:: buffers num of of range";
@@ -56,87 +113,265 @@ bool Transcriber::start_capture() {
     BOOST_LOG_TRIVIAL(info) << "transcriber:: buffer duration out of range";
   }
 
-  if (!capture_.open(config_.get_device_name(), rate_, channels_)) {
+  if (!parse_channel_groups()) {
+    return false;
+  }
+  if (stream_ && group_labels_.size() > 1) {
+    BOOST_LOG_TRIVIAL(fatal)
+        << "transcriber:: streaming mode supports a single channel group";
+    return false;
+  }
+
+  whispers_.clear();
+  for (const auto &group : group_labels_) {
+    /* pipeline and group in the logs and in the text sections */
+    std::string label = config_.get_pipeline_name();
+    if (!group.empty()) {
+      label += label.empty() ? group : " " + group;
+    }
+    whispers_.push_back(std::make_unique<Whisper>(
+        config_, model_, output_, label.empty() ? label : "[" + label + "]",
+        group, false, &settings_));
+  }
+
+  drafts_.clear();
+  if (draft_model_ && draft_scheduler_) {
+    if (stream_) {
+      /* the sliding window already emits partial text */
+      BOOST_LOG_TRIVIAL(warning)
+          << "transcriber:: draft model ignored in streaming mode";
+    } else {
+      for (size_t p = 0; p < whispers_.size(); p++) {
+        drafts_.push_back(std::make_unique<Whisper>(
+            config_, *draft_model_, output_, whispers_[p]->get_label(),
+            group_labels_[p], true, &settings_));
+      }
+    }
+  }
+
+  /* streams are ready before the device starts capturing */
+  for (auto &whisper : whispers_) {
+    if (!whisper->init()) {
+      BOOST_LOG_TRIVIAL(fatal) << "transcriber:: cannot open whisper";
+      return false;
+    }
+  }
+  for (auto &draft : drafts_) {
+    if (!draft->init()) {
+      BOOST_LOG_TRIVIAL(fatal) << "transcriber:: cannot open draft whisper";
+      return false;
+    }
+  }
+  if (config_.get_vad_enabled() && !vad_.is_enabled() &&
+      !vad_.init(config_.get_vad_model(), config_.get_vad_threshold())) {
+    BOOST_LOG_TRIVIAL(fatal) << "transcriber:: cannot load the VAD model";
+    return false;
+  }
+
+  capture_ = Capture::create(config_.get_device_name(), config_.get_paced());
+  /* the capture resamples the device rate to the whisper rate */
+  capture_->set_device_rate(config_.get_sample_rate());
+  capture_->set_buffer_params(config_.get_period_size(),
+                              config_.get_periods(),
+                              config_.get_buffer_time_ms(),
+                              config_.get_auto_tune());
+  if (!capture_->open(config_.get_device_name(), rate_, channels_, groups_,
+                      config_.get_use_mmap())) {
     BOOST_LOG_TRIVIAL(fatal) << "transcriber:: cannot open capture";
     return false;
   }
+  if (capture_->get_rate() != rate_) {
+    BOOST_LOG_TRIVIAL(fatal) << "transcriber:: capture rate "
+                             << capture_->get_rate() << " not supported";
+    return false;
+  }
 
-  bytes_per_frame_ = capture_.get_bytes_per_frame();
-  capture_.set_chunk_samples(8000); // 500 ms
-  chunk_samples_ = capture_.get_chunk_samples();
+  snd_pcm_uframes_t chunk_samples = rate_ / 2; // 500 ms
+  if (stream_) {
+    /* one buffer per step, transcription assembles the window */
+    uint16_t step_ms = config_.get_step_ms();
+    if (step_ms < 100 || step_ms > 2000) {
+      BOOST_LOG_TRIVIAL(info) << "transcriber:: stream step out of range";
+      step_ms = 500;
+    }
+    chunk_samples = rate_ * step_ms / 1000;
+  }
+  snd_pcm_uframes_t period = capture_->get_period_samples();
+  if (config_.get_auto_tune() && period) {
+    /* whole periods per chunk, every wake up reads complete periods */
+    chunk_samples = std::max<snd_pcm_uframes_t>(
+        (chunk_samples + period / 2) / period * period, period);
+    BOOST_LOG_TRIVIAL(info) << "transcriber:: chunk_samples " << chunk_samples
+                            << " aligned to " << chunk_samples / period
+                            << " periods of " << period;
+  }
+  capture_->set_chunk_samples(chunk_samples);
+  chunk_samples_ = capture_->get_chunk_samples();
   buffer_samples_ = rate_ * file_duration_ / chunk_samples_ * chunk_samples_;
+  size_t buffers_num = files_num_;
+  if (stream_) {
+    /* same amount of audio queued as in buffer mode */
+    buffers_num = files_num_ * buffer_samples_ / chunk_samples_;
+    buffer_samples_ = chunk_samples_;
+    window_samples_ = std::max<size_t>(
+        rate_ * config_.get_window_ms() / 1000 / chunk_samples_ *
+            chunk_samples_,
+        2 * chunk_samples_);
+    overlap_samples_ = std::min<size_t>(rate_ * config_.get_keep_ms() / 1000,
+                                        window_samples_ / 2);
+    window_.assign(window_samples_, 0);
+    window_len_ = 0;
+    window_start_ = 0;
+    window_voiced_ = false;
+    silence_run_ = 0;
+    BOOST_LOG_TRIVIAL(info) << "transcriber:: streaming step "
+                            << chunk_samples_ << " window " << window_samples_
+                            << " overlap " << overlap_samples_ << " samples";
+  }
   BOOST_LOG_TRIVIAL(debug) << "transcriber:: buffer_samples "
                            << buffer_samples_;
 
-  buffer_.reset(new uint8_t[buffer_samples_ * bytes_per_frame_]);
-  if (buffer_ == nullptr) {
-    BOOST_LOG_TRIVIAL(fatal) << "transcriber:: cannot allocate audio buffer";
+  if (!ring_.init(buffers_num, buffer_samples_, group_labels_.size())) {
+    BOOST_LOG_TRIVIAL(fatal) << "transcriber:: cannot allocate audio buffers";
+    return false;
+  }
+
+  {
+    auto &metrics = Metrics::get();
+    auto labels = Metrics::label("pipeline", get_name());
+    auto buffers = [&](const char *result) {
+      return &metrics.counter("whisper_alsa_buffers_total",
+                              "Captured buffers by outcome",
+                              labels + "," + Metrics::label("result", result));
+    };
+    voiced_buffers_ = buffers("voiced");
+    silent_buffers_ = buffers("silent");
+    dropped_buffers_ = buffers("dropped");
+    silence_samples_total_ =
+        &metrics.counter("whisper_alsa_silence_dropped_samples_total",
+                         "Samples dropped as silence before transcription",
+                         labels);
+    ring_queued_ = &metrics.gauge("whisper_alsa_ring_queued",
+                                  "Buffers waiting for transcription", labels);
+    metrics.gauge("whisper_alsa_ring_blocks", "Audio ring capacity", labels)
+        .set(buffers_num);
+    promoted_buffers_ = buffers("draft_final");
+  }
+
+  /* in streaming mode the segmenter only classifies steps */
+  segmenter_.init(rate_, silence_threshold_,
+                  stream_ ? SIZE_MAX
+                          : rate_ * config_.get_min_segment_ms() / 1000,
+                  rate_ * config_.get_pause_ms() / 1000,
+                  group_labels_.size(),
+                  config_.get_vad_enabled() ? &vad_ : nullptr);
+  planes_.assign(group_labels_.size(), nullptr);
+
+  /* the output file is a text sink, stdout without sinks */
+  std::string sinks = config_.get_sinks();
+  if (sinks.empty()) {
+    sinks = config_.get_output().empty() ? "stdout"
+                                         : "file:" + config_.get_output();
+  }
+  output_.get_store().init(
+      config_.get_store_segments(),
+      std::chrono::seconds(config_.get_store_retention_s()));
+  if (!output_.open(sinks, get_name())) {
+    BOOST_LOG_TRIVIAL(fatal) << "transcriber:: cannot open output sinks";
     return false;
   }
 
+  if (!drafts_.empty()) {
+    /* finalize while the model leaves half of the ring free */
+    final_backlog_ = std::max<size_t>(buffers_num / 2, 1) * drafts_.size();
+  }
+
   buffer_offset_ = 0;
-  file_id_ = 0;
-  file_counter_ = 0;
+  position_ = 0;
+  silence_samples_ = 0;
+  silence_reset_ = false;
+  capture_done_ = false;
+  done_ = false;
   running_ = true;
 
-  open_files(file_id_);
+  open_files();
 
   /* start transcribing on a separate thread */
   res_trans_ = std::async(std::launch::async, [&]() {
     BOOST_LOG_TRIVIAL(debug) << "transcriber:: transcriptions loop start";
-    if (!whisper_.init()) {
-      BOOST_LOG_TRIVIAL(fatal) << "transcriber:: cannot open whisper";
-      return false;
-    }
+    Trace::set_thread_name("transcriber " + get_name());
+    next_block_ = 0;
 
-    uint32_t current_file_conter = 0;
-    uint8_t file_id = 0;
-    while (1) {
-      std::unique_lock whisper_lock(whisper_mutex_);
-      /* wait for a new file to complete */
-      whisper_cond_.wait(whisper_lock, [&] {
-        return !running_ ||
-               (file_counter_ > 0 && current_file_conter != file_counter_);
-      });
-      current_file_conter++;
-      whisper_lock.unlock();
+    while (running_) {
+      if (stream_ && flush_.exchange(false)) {
+        stream_flush();
+      }
+      /* all the buffers are published once the capture is done */
+      bool capture_done = capture_done_;
+      /* wait for a new buffer to complete */
+      if (!ring_.wait(100ms)) {
+        if (capture_done)
+          break;
+        continue;
+      }
 
-      if (!running_)
-        break;
+      if (stream_) {
+        stream_blocks();
+        continue;
+      }
 
-      if (file_id == file_id_.load()) {
-        BOOST_LOG_TRIVIAL(error)
-            << "transcriber:: requesting current capture file, "
-            << "probably running to slow, skipping file "
-            << std::to_string(file_id);
-      } else {
-        auto samples_num = output_bufs_[file_id].size();
-        BOOST_LOG_TRIVIAL(info)
-            << "transcriber:: file " << (int)file_id << " samples "
-            << samples_num << " capturing file " << (int)file_id_.load();
-
-        if (samples_num > keep_samples_) {
-          whisper_.transribe(output_bufs_[file_id].data(), samples_num);
-        } else {
-          whisper_.segment();
-        }
+      /* hand all the new buffers over to the workers */
+      AudioRing::Block *block;
+      while ((block = ring_.get(next_block_)) != nullptr) {
+        transcribe_block(*block);
+        next_block_++;
       }
-      /* increase file id to process */
-      file_id = (file_id + 1) % files_num_;
     }
 
+    if (stream_) {
+      stream_flush();
+    }
+
+    /* wait for the pending buffers, drafts queue the model jobs */
+    if (!drafts_.empty()) {
+      draft_scheduler_->drain(draft_queue_);
+    }
+    scheduler_.drain(queue_);
+
     /* close Whispers*/
-    whisper_.terminate();
+    for (auto &whisper : whispers_) {
+      whisper->terminate();
+    }
+    for (auto &draft : drafts_) {
+      draft->terminate();
+    }
 
+    done_ = capture_done_.load();
     BOOST_LOG_TRIVIAL(debug) << "transcriber:: transcriptions loop end";
     return true;
   });
 
-  auto status_trans = res_trans_.wait_for(1s);
-  if (status_trans != std::future_status::timeout) {
-    /* sync task terminated prematurely */
-    running_ = false;
-    return false;
+  /* start capturing on the shared capture loop */
+  std::vector<pollfd> fds;
+  if (capture_loop_ && capture_->get_poll_fds(fds)) {
+    BOOST_LOG_TRIVIAL(debug)
+        << "transcriber:: audio capture on the capture loop, chunk_samples = "
+        << chunk_samples_;
+    set_planes(ring_.producer_block(), buffer_offset_);
+    capture_->begin_read(planes_.data());
+    /* the first read starts the device */
+    if (!capture_ready(fds.data(), fds.size())) {
+      return false;
+    }
+    capture_source_ = capture_loop_->add(
+        fds, [this](pollfd *fds, size_t fds_num) {
+          return capture_ready(fds, fds_num);
+        });
+    if (!capture_source_) {
+      BOOST_LOG_TRIVIAL(fatal) << "transcriber:: cannot poll the capture";
+      return false;
+    }
+    return true;
   }
 
   /* start capturing on a separate thread */
@@ -144,97 +379,426 @@ bool Transcriber::start_capture() {
     BOOST_LOG_TRIVIAL(debug)
         << "transcriber:: audio capture loop start, chunk_samples = "
         << chunk_samples_;
+    Topology::set_capture_thread(config_);
+    Trace::set_thread_name("capture " + get_name());
     while (running_) {
-      if ((capture_.read(buffer_.get() + buffer_offset_ * bytes_per_frame_)) <
-          0) {
+      /* capture converts straight into the current buffer */
+      set_planes(ring_.producer_block(), buffer_offset_);
+      int read;
+      {
+        TraceSpan span("capture_read", ring_.producer_id());
+        read = capture_->read(planes_.data());
+      }
+      if (read < 0) {
+        if (capture_->is_eof()) {
+          /* end of a replayed source, transcribe what is left */
+          if (buffer_offset_ > 0) {
+            close_files(buffer_offset_);
+          }
+          capture_done_ = true;
+        }
         break;
       }
 
-      save_files(file_id_);
-      buffer_offset_ += chunk_samples_;
+      save_files();
+    }
+    BOOST_LOG_TRIVIAL(debug) << "transcriber:: audio capture loop end";
+    return true;
+  });
+ 
 
-      /* check if buffer is full */
-      if ((buffer_offset_ + chunk_samples_) > buffer_samples_) {
-        close_files(file_id_);
+  return true;
+}
+
+bool Transcriber::set_setting(const std::string &key,
+                              const std::string &value, std::string &error) {
+  if (!settings_.set(key, value, error)) {
+    return false;
+  }
+  if (key == "use_context") {
+    /* a buffer waits for the prompt of the previous one */
+    bool use_context = settings_.get()->use_context;
+    scheduler_.set_serialize(queue_, use_context);
+    if (draft_scheduler_) {
+      draft_scheduler_->set_serialize(draft_queue_, use_context);
+    }
+  }
+  return true;
+}
 
-        std::lock_guard<std::mutex> lock(whisper_mutex_);
-        /* increase file id */
-        file_id_ = (file_id_ + 1) % files_num_;
-        file_counter_++;
-        whisper_cond_.notify_one();
+void Transcriber::pause(bool paused) {
+  if (paused_.exchange(paused) != paused) {
+    BOOST_LOG_TRIVIAL(info) << "transcriber:: " << get_name()
+                            << (paused ? " paused" : " resumed");
+  }
+}
 
-        buffer_offset_ = 0;
+std::string Transcriber::get_stats() const {
+  std::ostringstream os;
+  os << "running=" << running_ << " paused=" << paused_;
+  if (voiced_buffers_) {
+    os << " voiced_buffers=" << voiced_buffers_->get()
+       << " silent_buffers=" << silent_buffers_->get()
+       << " dropped_buffers=" << dropped_buffers_->get()
+       << " silence_dropped_samples=" << silence_samples_total_->get()
+       << " ring_queued=" << ring_queued_->get();
+  }
+  os << " jobs_pending=" << scheduler_.get_pending(queue_)
+     << " decode_level=" << scheduler_.get_overload().get_level().name
+     << " last_seq=" << get_last_seq();
+  return os.str();
+}
 
-        open_files(file_id_);
+bool Transcriber::capture_ready(pollfd *fds, size_t fds_num) {
+  if (!running_) {
+    return false;
+  }
+  ssize_t read;
+  {
+    TraceSpan span("capture_read", ring_.producer_id());
+    read = capture_->poll_read(fds, fds_num);
+  }
+  if (read < 0) {
+    BOOST_LOG_TRIVIAL(error) << "transcriber:: audio capture of "
+                             << get_name() << " stopped";
+    return false;
+  }
+  if (read > 0) {
+    /* a chunk per event, the loop calls again while frames are ready */
+    save_files();
+    set_planes(ring_.producer_block(), buffer_offset_);
+    capture_->begin_read(planes_.data());
+  }
+  return true;
+}
+
+void Transcriber::transcribe_block(const AudioRing::Block &block) {
+  BOOST_LOG_TRIVIAL(info) << "transcriber:: buffer " << block.id
+                          << " samples " << block.samples << " queued "
+                          << scheduler_.get_pending(queue_);
+
+  for (size_t p = 0; p < whispers_.size(); p++) {
+    Whisper *whisper = whispers_[p].get();
+    /* give the buffer back to the capture thread with the last result */
+    bool last = p + 1 == whispers_.size();
+    auto release = [this, last]() {
+      if (last) {
+        ring_.pop();
+        ring_queued_->set(ring_.size());
       }
+    };
+
+    bool voiced = block.voiced && (block.voiced_planes >> p & 1) &&
+                  block.samples > keep_samples_;
+    if (!drafts_.empty()) {
+      transcribe_draft(block, p, voiced, release);
+    } else if (voiced) {
+      auto result = std::make_shared<Whisper::Result>();
+      const float *in = block.plane(p) + block.offset;
+      uint32_t samples = block.samples;
+      int64_t offset = to_ticks(block.position + block.offset);
+      int64_t id = block.id;
+      scheduler_.submit(
+          queue_, p,
+          [whisper, result, in, samples, id](Worker &worker) {
+            TraceSpan span("transcribe", id);
+            whisper->transribe(worker, in, samples, *result);
+          },
+          [whisper, result, offset, release, id]() {
+            TraceSpan span("process_result", id);
+            whisper->process_result(*result, offset);
+            release();
+          });
+    } else {
+      scheduler_.submit(queue_, p, nullptr, [whisper, release]() {
+        whisper->segment();
+        release();
+      });
     }
-    BOOST_LOG_TRIVIAL(debug) << "transcriber:: audio capture loop end";
+  }
+}
 
-    /* notify transcription for termination*/
-    std::lock_guard<std::mutex> lock(whisper_mutex_);
-    whisper_cond_.notify_one();
+void Transcriber::transcribe_draft(const AudioRing::Block &block,
+                                   size_t plane, bool voiced,
+                                   std::function<void()> release) {
+  Whisper *draft = drafts_[plane].get();
+  Whisper *whisper = whispers_[plane].get();
+  /* draft results complete in order, so do the model jobs they queue */
+  if (!voiced) {
+    draft_scheduler_->submit(
+        draft_queue_, plane, nullptr,
+        [this, plane, draft, whisper, release]() {
+          draft->segment();
+          scheduler_.submit(queue_, plane, nullptr, [whisper, release]() {
+            whisper->segment();
+            release();
+          });
+        });
+    return;
+  }
 
-    return true;
-  });
- 
+  auto result = std::make_shared<Whisper::Result>();
+  const float *in = block.plane(plane) + block.offset;
+  uint32_t samples = block.samples;
+  int64_t offset = to_ticks(block.position + block.offset);
+  int64_t id = block.id;
+  draft_scheduler_->submit(
+      draft_queue_, plane,
+      [draft, result, in, samples, id](Worker &worker) {
+        TraceSpan span("draft_transcribe", id);
+        draft->transribe(worker, in, samples, *result);
+      },
+      [this, plane, draft, whisper, result, in, samples, offset, release,
+       id]() {
+        TraceSpan span("draft_process_result", id);
+        if (scheduler_.get_pending(queue_) >= final_backlog_) {
+          /* the model is falling behind, keep the draft text */
+          draft->process_result(*result, offset);
+          promoted_buffers_->add();
+          scheduler_.submit(queue_, plane, nullptr, [whisper, release]() {
+            whisper->segment();
+            release();
+          });
+          return;
+        }
+        draft->process_result(*result, offset, true);
+        auto final_result = std::make_shared<Whisper::Result>();
+        scheduler_.submit(
+            queue_, plane,
+            [whisper, final_result, in, samples, id](Worker &worker) {
+              TraceSpan span("transcribe", id);
+              whisper->transribe(worker, in, samples, *final_result);
+            },
+            [whisper, final_result, offset, release, id]() {
+              TraceSpan span("process_result", id);
+              whisper->process_result(*final_result, offset);
+              release();
+            });
+      });
+}
 
-  return true;
+void Transcriber::set_planes(const AudioRing::Block &block, size_t offset) {
+  for (size_t p = 0; p < planes_.size(); p++) {
+    planes_[p] = block.plane(p) + offset;
+  }
 }
 
-void Transcriber::open_files(uint8_t file_id) {
-  BOOST_LOG_TRIVIAL(debug) << "transcriber:: opening file with id "
-                           << std::to_string(file_id) << " ...";
-  tmp_buf_.clear();
-  silence_samples_ = 0;
+void Transcriber::open_files() {
+  BOOST_LOG_TRIVIAL(trace) << "transcriber:: opening buffer at sample "
+                           << position_ << " ...";
 }
 
-void Transcriber::save_files(uint8_t file_id) {
-  auto sample_size = bytes_per_frame_ / channels_;
-  for (size_t offset = 0; offset < chunk_samples_; offset++) {
-    float pcmFloat{0};
-    for (uint16_t ch = 0; ch < channels_; ch++) {
-      /* extract mapped channels and converted pcm from int to float */
-      uint8_t *in = buffer_.get() +
-                    (buffer_offset_ + offset) * bytes_per_frame_ +
-                    ch * sample_size;
-      switch (sample_size) {
-      case 2: {
-        int16_t pcm = *in | (*(in + 1) << 8);
-        pcmFloat += static_cast<float>(pcm) / 32768.0f;
-      } break;
-      case 3: {
-        int32_t pcm = *in | (*(in + 1) << 8) | (*(in + 2) << 16);
-        // If the most significant bit of the 24th bit is set
-        if (*(in + 2) & 0x80) {
-          pcm |= (0xFF << 24); // Fill the upper 8 bits with 1s
-        }
-        pcmFloat += static_cast<float>(pcm) / 8388608.0f;
-      } break;
-      case 4: {
-        int32_t pcm =
-            *in | (*(in + 1) << 8) | (*(in + 2) << 16) | (*(in + 3) << 24);
-        pcmFloat += static_cast<float>(pcm) / 2147483648.0f;
-      } break;
-      }
+void Transcriber::save_files() {
+  if (paused_) {
+    /* the audio before the pause is transcribed, the chunks read while
+       paused are dropped and the timestamps keep counting */
+    if (buffer_offset_ > 0) {
+      close_files(buffer_offset_);
     }
+    position_ += chunk_samples_;
+    return;
+  }
 
-    if (std::fabs(pcmFloat) < silence_threshold_) {
-      silence_samples_++;
+  /* settings changes apply between chunks */
+  auto settings = settings_.get();
+  segmenter_.set_threshold(settings->silence_threshold);
+  vad_.set_threshold(settings->vad_threshold);
+
+  auto &block = ring_.producer_block();
+  bool pause = segmenter_.process(planes_.data(), chunk_samples_);
+  buffer_offset_ += chunk_samples_;
+
+  if (stream_) {
+    /* every step is handed over */
+    close_files(buffer_offset_);
+  } else if (pause) {
+    close_files(segmenter_.get_cut());
+  } else if (flush_.exchange(false)) {
+    close_files(buffer_offset_);
+  } else if ((buffer_offset_ + chunk_samples_) > buffer_samples_) {
+    /* buffer is full, cut at the quietest frame */
+    close_files(segmenter_.get_quietest());
+  } else if (!segmenter_.has_speech() &&
+             buffer_offset_ > segmenter_.get_pad_samples()) {
+    /* no speech yet, keep the pre-roll only */
+    size_t drop = buffer_offset_ - segmenter_.get_pad_samples();
+    silence_samples_ += drop;
+    silence_samples_total_->add(drop);
+    if (silence_samples_ >= buffer_samples_ && !silence_reset_) {
+      /* an empty buffer tells transcription to reset the context */
+      silence_reset_ = true;
+      close_files(drop);
+      return;
+    }
+    for (size_t p = 0; p < planes_.size(); p++) {
+      std::memmove(block.plane(p), block.plane(p) + drop,
+                   (buffer_offset_ - drop) * sizeof(float));
     }
-    tmp_buf_.push_back(pcmFloat);
+    segmenter_.discard(drop);
+    buffer_offset_ -= drop;
+    position_ += drop;
   }
 }
 
-void Transcriber::close_files(uint8_t file_id) {
-  BOOST_LOG_TRIVIAL(debug) << "transcriber:: silence samples "
-                           << silence_samples_;
-  output_bufs_[file_id].clear();
-  if (buffer_samples_ - silence_samples_ > keep_samples_) {
-    std::copy(tmp_buf_.begin(), tmp_buf_.end(),
-              back_inserter(output_bufs_[file_id]));
+void Transcriber::close_files(size_t cut) {
+  TraceSpan span("buffer_close", ring_.producer_id());
+  auto &block = ring_.producer_block();
+  block.position = position_;
+  if (stream_) {
+    block.offset = 0;
+    block.samples = cut;
+    block.voiced = segmenter_.has_speech();
+  } else {
+    /* trim leading and trailing silence */
+    size_t end = std::min(segmenter_.get_end(), cut);
+    block.offset = segmenter_.get_begin();
+    block.samples = end > block.offset ? end - block.offset : 0;
+    block.voiced = block.samples > keep_samples_;
+    block.voiced_planes = segmenter_.get_speech_planes();
+    if (block.voiced) {
+      silence_samples_ = 0;
+      silence_reset_ = false;
+    }
+    BOOST_LOG_TRIVIAL(debug)
+        << "transcriber:: closing buffer at sample " << position_ << " cut "
+        << cut << " speech " << block.offset << " -> " << end
+        << " noise floor " << segmenter_.get_noise_floor();
+  }
+
+  bool published = ring_.publish();
+  /* a replayed source waits for the transcription instead of dropping */
+  while (!published && !capture_->is_realtime() && running_) {
+    std::this_thread::sleep_for(10ms);
+    published = ring_.publish();
+  }
+  if (!published) {
+    BOOST_LOG_TRIVIAL(error)
+        << "transcriber:: no free audio buffer, "
+        << "probably running to slow, skipping buffer";
+    dropped_buffers_->add();
   } else {
-    BOOST_LOG_TRIVIAL(info) << "transcriber:: skipping buffer with "
-                            << silence_samples_ << " silence samples";
+    (block.voiced ? voiced_buffers_ : silent_buffers_)->add();
+    ring_queued_->set(ring_.size());
+  }
+
+  /* carry the audio past the cut over to the next buffer */
+  auto &next = ring_.producer_block();
+  size_t tail = buffer_offset_ - cut;
+  for (size_t p = 0; p < planes_.size(); p++) {
+    std::memmove(next.plane(p), block.plane(p) + cut, tail * sizeof(float));
+  }
+  position_ += cut;
+  buffer_offset_ = tail;
+  segmenter_.reset(cut);
+  open_files();
+  set_planes(next, 0);
+  if (tail && segmenter_.process(planes_.data(), tail)) {
+    close_files(segmenter_.get_cut());
+  }
+}
+
+int64_t Transcriber::to_ticks(int64_t samples) const {
+  /* whisper timestamps are in 10 ms units */
+  return samples / (rate_ / 100);
+}
+
+void Transcriber::stream_transcribe(int64_t final) {
+  Whisper *whisper = whispers_.front().get();
+  auto result = std::make_shared<Whisper::Result>();
+  const float *in = window_.data();
+  uint32_t samples = window_len_;
+  int64_t offset = to_ticks(window_start_);
+  scheduler_.submit(
+      queue_, 0,
+      [whisper, result, in, samples](Worker &worker) {
+        TraceSpan span("transcribe");
+        whisper->transribe(worker, in, samples, *result);
+      },
+      [whisper, result, offset, final]() {
+        TraceSpan span("process_result");
+        whisper->process_stream_result(*result, offset, final);
+      });
+  /* the window slides on the committed position */
+  scheduler_.drain(queue_);
+}
+
+void Transcriber::stream_slide(int64_t start) {
+  start = std::clamp(start, window_start_, window_start_ + (int64_t)window_len_);
+  size_t drop = start - window_start_;
+  std::memmove(window_.data(), window_.data() + drop,
+               (window_len_ - drop) * sizeof(float));
+  window_len_ -= drop;
+  window_start_ = start;
+}
+
+void Transcriber::stream_append(const AudioRing::Block &block) {
+  int64_t position = block.position + block.offset;
+  if (position != window_start_ + (int64_t)window_len_) {
+    /* audio was dropped, close the window and start over */
+    stream_flush();
+    window_start_ = position;
+    window_len_ = 0;
+  }
+
+  if (window_len_ + block.samples > window_samples_) {
+    /* window full: commit the stable part and slide past it */
+    int64_t end = window_start_ + window_len_;
+    int64_t start = end - overlap_samples_;
+    if (window_voiced_) {
+      stream_transcribe(to_ticks(end - overlap_samples_));
+      int64_t committed = whispers_.front()->get_committed() * (rate_ / 100);
+      start = std::clamp<int64_t>(committed - overlap_samples_,
+                                  window_start_ + chunk_samples_,
+                                  end - overlap_samples_);
+    }
+    stream_slide(start);
+  }
+
+  std::memcpy(window_.data() + window_len_, block.data + block.offset,
+              block.samples * sizeof(float));
+  window_len_ += block.samples;
+  if (block.voiced) {
+    window_voiced_ = true;
+    silence_run_ = 0;
+  } else {
+    silence_run_ += block.samples;
+  }
+}
+
+void Transcriber::stream_flush() {
+  if (window_voiced_ && window_len_ > keep_samples_) {
+    /* everything left in the window is final */
+    stream_transcribe(INT64_MAX);
+  }
+  whispers_.front()->segment();
+  /* keep the overlap tail as pre-roll of the next speech */
+  stream_slide(window_start_ + window_len_ - overlap_samples_);
+  window_voiced_ = false;
+}
+
+void Transcriber::stream_blocks() {
+  AudioRing::Block *block;
+  bool appended{false};
+  /* catch up with all the queued steps and run whisper once */
+  while ((block = ring_.front()) != nullptr) {
+    stream_append(*block);
+    ring_.pop();
+    ring_queued_->set(ring_.size());
+    appended = true;
+  }
+  if (!appended) {
+    return;
+  }
+
+  if (!window_voiced_) {
+    /* nothing to transcribe, keep the overlap tail only */
+    stream_slide(window_start_ + window_len_ - overlap_samples_);
+  } else if (silence_run_ >= chunk_samples_) {
+    /* pause after speech */
+    stream_flush();
+  } else {
+    /* nothing is final yet, emit the window as partial */
+    stream_transcribe(-1);
   }
 }
 
@@ -244,9 +808,16 @@ bool Transcriber::stop_capture() {
 
   BOOST_LOG_TRIVIAL(info) << "transcriber:: stopping audio capture ... ";
   running_ = false;
+  if (capture_source_) {
+    capture_loop_->remove(capture_source_);
+    capture_source_ = 0;
+  }
   bool ret = res_trans_.get();
-  ret = res_capts_.get();
-  capture_.close();
+  if (res_capts_.valid()) {
+    ret = res_capts_.get();
+  }
+  capture_->close();
+  output_.close();
   return ret;
 }
 
@@ -254,23 +825,3 @@ bool Transcriber::terminate() {
   BOOST_LOG_TRIVIAL(info) << "transcriber:: terminating ... ";
   return stop_capture();
 }
-
-bool Transcriber::get_text(std::string &out) {
-  if (!running_) {
-    BOOST_LOG_TRIVIAL(warning) << "Transcriber:: not running";
-    return false;
-  }
-
-  out = whisper_.get_text();
-  return true;
-}
-
-bool Transcriber::clear_text() {
-  if (!running_) {
-    BOOST_LOG_TRIVIAL(warning) << "Transcriber:: not running";
-    return false;
-  }
-
-  whisper_.clear_text();
-  return true;
-}
@@ -15,65 +15,164 @@
 #define _WHISPER_HPP_
 
 #include <alsa/asoundlib.h>
-#include <condition_variable>
 #include <cstdlib>
+#include <functional>
 #include <future>
 #include <iostream>
-#include <map>
 #include <memory>
 #include <sstream>
 #include <vector>
 
 #include "capture.hpp"
 #include "config.hpp"
+#include "metrics.hpp"
+#include "model.hpp"
+#include "capture_loop.hpp"
+#include "ring.hpp"
+#include "scheduler.hpp"
+#include "segmenter.hpp"
+#include "settings.hpp"
+#include "vad.hpp"
 #include "whisper.hpp"
 
+/*
+ * Capture pipeline: one capture device transcribed on the model and
+ * the inference workers shared by all the pipelines of the process.
+ * With a draft model every buffer is first transcribed by the draft
+ * workers and emitted as partial, then transcribed again by the model
+ * while its workers keep up, the draft text is final otherwise.
+ * Devices that can be polled are read by a shared CaptureLoop when
+ * given one, instead of a capture thread of their own.
+ */
 class Transcriber {
 public:
-  static std::shared_ptr<Transcriber> create(const Config &config);
+  Transcriber(const Config &config, Model &model, Scheduler &scheduler,
+              Model *draft_model = nullptr,
+              Scheduler *draft_scheduler = nullptr,
+              CaptureLoop *capture_loop = nullptr)
+      : config_(config), model_(model), scheduler_(scheduler),
+        draft_model_(draft_model), draft_scheduler_(draft_scheduler),
+        capture_loop_(capture_loop){};
   Transcriber() = delete;
+  Transcriber(const Transcriber &) = delete;
+  ~Transcriber() { stop_capture(); }
 
   bool init();
   bool terminate();
 
-  bool get_text(std::string &out);
-  bool clear_text();
-
   bool start_capture();
   bool stop_capture();
+  /* a replayed source was transcribed to the end */
+  bool is_done() const { return done_; }
+
+  const std::string &get_name() const;
 
-protected:
-  explicit Transcriber(const Config &config) : config_(config){};
+  /* transcript segments after seq, see SegmentStore */
+  size_t get_segments_since(uint64_t seq, std::vector<TextSegment> &out,
+                            size_t max = SIZE_MAX) const {
+    return output_.get_store().get_segments_since(seq, out, max);
+  }
+  uint64_t get_last_seq() const { return output_.get_store().get_last_seq(); }
+
+  /* runtime control, applied from the next captured chunk */
+  const Settings &get_settings() const { return settings_; }
+  bool set_setting(const std::string &key, const std::string &value,
+                   std::string &error);
+  /* drop the captured audio while paused, the device keeps running */
+  void pause(bool paused);
+  bool is_paused() const { return paused_; }
+  /* transcribe the audio captured so far without waiting for a pause */
+  void flush() { flush_ = true; }
+  /* key=value list of the pipeline counters */
+  std::string get_stats() const;
 
 private:
-  void open_files(uint8_t files_id);
-  void close_files(uint8_t files_id);
-  void save_files(uint8_t files_id);
+  bool parse_channel_groups();
+  void set_planes(const AudioRing::Block &block, size_t offset);
+  void transcribe_block(const AudioRing::Block &block);
+  void transcribe_draft(const AudioRing::Block &block, size_t plane,
+                        bool voiced, std::function<void()> release);
+  void open_files();
+  void close_files(size_t cut);
+  void save_files();
+  /* capture loop handler of the capture descriptors */
+  bool capture_ready(pollfd *fds, size_t fds_num);
+
+  /* sliding window streaming */
+  int64_t to_ticks(int64_t samples) const;
+  void stream_blocks();
+  void stream_transcribe(int64_t final);
+  void stream_append(const AudioRing::Block &block);
+  void stream_slide(int64_t start);
+  void stream_flush();
 
   const Config &config_;
   uint16_t file_duration_{5};
   uint8_t files_num_{4};
   uint8_t channels_{4};
+  /* channel to group map, empty when all channels are downmixed */
+  std::vector<uint8_t> groups_;
+  std::vector<std::string> group_labels_;
+  /* capture write position in every plane of the current buffer */
+  std::vector<float *> planes_;
   float silence_threshold_{1e-4};
   uint16_t keep_samples_{1600};
   snd_pcm_uframes_t chunk_samples_{0};
-  size_t bytes_per_frame_{0};
   size_t buffer_samples_{0};
   uint32_t buffer_offset_{0};
-  uint32_t silence_samples_;
-  std::vector<float> tmp_buf_;
-  std::map<uint8_t, std::vector<float>> output_bufs_;
-  uint32_t file_counter_{0};
-  std::atomic<uint8_t> file_id_{0};
-  std::unique_ptr<uint8_t[]> buffer_;
+  /* silence dropped since the last buffer with speech */
+  size_t silence_samples_{0};
+  bool silence_reset_{false};
+  Segmenter segmenter_;
+  /* voice activity detection of the segmenter, loaded once */
+  Vad vad_;
+  int64_t position_{0};
+  AudioRing ring_;
+  /* next buffer to hand over to the scheduler */
+  uint64_t next_block_{0};
+  bool stream_{false};
+  std::vector<float> window_;
+  size_t window_samples_{0};
+  size_t window_len_{0};
+  int64_t window_start_{0};
+  size_t overlap_samples_{0};
+  size_t silence_run_{0};
+  bool window_voiced_{false};
   uint32_t rate_{16000};
   std::future<bool> res_capts_;
   std::future<bool> res_trans_;
   std::atomic_bool running_{false};
-  Capture capture_;
-  std::mutex whisper_mutex_;
-  std::condition_variable whisper_cond_;
-  Whisper whisper_{config_};
+  std::atomic_bool capture_done_{false};
+  std::atomic_bool done_{false};
+  Settings settings_;
+  std::atomic_bool paused_{false};
+  std::atomic_bool flush_{false};
+  std::unique_ptr<Capture> capture_;
+  /* sinks of the transcribed segments */
+  Output output_;
+  /* one transcription stream per channel group sharing the model */
+  Model &model_;
+  std::vector<std::unique_ptr<Whisper>> whispers_;
+  Scheduler &scheduler_;
+  /* scheduler queue keeping the results of the pipeline in order */
+  size_t queue_{0};
+  /* draft model cascade, disabled without draft model */
+  Model *draft_model_{nullptr};
+  Scheduler *draft_scheduler_{nullptr};
+  std::vector<std::unique_ptr<Whisper>> drafts_;
+  size_t draft_queue_{0};
+  /* model jobs queued above which the draft text is final */
+  size_t final_backlog_{0};
+  Counter *promoted_buffers_{nullptr};
+  /* live metrics of the pipeline */
+  Counter *voiced_buffers_{nullptr};
+  Counter *silent_buffers_{nullptr};
+  Counter *dropped_buffers_{nullptr};
+  Counter *silence_samples_total_{nullptr};
+  Gauge *ring_queued_{nullptr};
+  /* shared capture thread, a thread per capture without */
+  CaptureLoop *capture_loop_{nullptr};
+  uint64_t capture_source_{0};
 };
 
 #endif
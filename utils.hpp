@@ -19,6 +19,7 @@
 #include <iostream>
 
 #include "log.hpp"
+#include "trace.hpp"
 
 class TimeElapsed {
 public:
@@ -26,6 +27,7 @@ public:
   TimeElapsed(const std::string &desc) {
     desc_ = desc;
     start_ = std::chrono::high_resolution_clock::now();
+    begin_ = Trace::clock::now();
   }
 
   uint32_t elapsed() {
@@ -36,9 +38,11 @@ public:
 
   ~TimeElapsed() {
     BOOST_LOG_TRIVIAL(info) << desc_ << " returned in " << elapsed() << " ms";
+    Trace::add(desc_.c_str(), begin_, Trace::clock::now());
   }
 
 private:
+  Trace::clock::time_point begin_;
   std::chrono::_V2::system_clock::time_point start_;
   std::string desc_;
 };
@@ -0,0 +1,109 @@
+//
+//  vad.cpp
+//
+//  Copyright (c) 2019 2025 Andrea Bondavalli. All rights reserved.
+//
+//  This program is free software: you can redistribute it and/or modify
+//  it under the terms of the MIT license
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+//
+
+#include <algorithm>
+#include <whisper.h>
+
+#include "log.hpp"
+#include "utils.hpp"
+#include "vad.hpp"
+
+bool Vad::init(const std::string &model, float threshold, int n_threads) {
+  terminate();
+
+  TimeElapsed ts{"vad:: init"};
+  struct whisper_vad_context_params params =
+      whisper_vad_default_context_params();
+  params.n_threads = n_threads;
+  /* a few windows at a time don't pay off on a GPU */
+  params.use_gpu = false;
+  ctx_ = whisper_vad_init_from_file_with_params(model.c_str(), params);
+  if (!ctx_) {
+    BOOST_LOG_TRIVIAL(fatal)
+        << "vad:: whisper_vad_init_from_file_with_params() failed";
+    return false;
+  }
+  threshold_ = threshold;
+  buffer_.reserve((history_windows + 64) * window_samples);
+  reset();
+  return true;
+}
+
+void Vad::terminate() {
+  if (ctx_) {
+    whisper_vad_free(ctx_);
+    ctx_ = nullptr;
+  }
+}
+
+void Vad::reset() {
+  buffer_.clear();
+  history_ = 0;
+  probs_.clear();
+  first_window_ = 0;
+}
+
+void Vad::process(const float *const *in, size_t planes, size_t samples) {
+  if (!ctx_ || !samples) {
+    return;
+  }
+  size_t start = buffer_.size();
+  buffer_.resize(start + samples);
+  float gain = 1.0f / planes;
+  for (size_t i = 0; i < samples; i++) {
+    float sum{0};
+    for (size_t p = 0; p < planes; p++) {
+      sum += in[p][i];
+    }
+    buffer_[start + i] = sum * gain;
+  }
+
+  size_t windows = (buffer_.size() - history_) / window_samples;
+  if (!windows) {
+    return;
+  }
+  size_t history_num = history_ / window_samples;
+  size_t analyzed = history_ + windows * window_samples;
+  if (!whisper_vad_detect_speech(ctx_, buffer_.data(), analyzed)) {
+    BOOST_LOG_TRIVIAL(error) << "vad:: whisper_vad_detect_speech() failed";
+    /* keep going as speech, better than losing it */
+    probs_.insert(probs_.end(), windows, 1.0f);
+  } else {
+    const float *probs = whisper_vad_probs(ctx_);
+    size_t n_probs = whisper_vad_n_probs(ctx_);
+    for (size_t w = 0; w < windows; w++) {
+      size_t index = history_num + w;
+      probs_.push_back(index < n_probs ? probs[index] : 0.0f);
+    }
+  }
+  while (probs_.size() > max_windows) {
+    probs_.pop_front();
+    first_window_++;
+  }
+
+  /* the last analyzed windows are the history of the next call */
+  size_t history = std::min(analyzed, history_windows * window_samples);
+  buffer_.erase(buffer_.begin(), buffer_.begin() + (analyzed - history));
+  history_ = history;
+}
+
+float Vad::get_probability(uint64_t position) const {
+  if (probs_.empty()) {
+    return 0.0f;
+  }
+  uint64_t window = position / window_samples;
+  if (window < first_window_) {
+    return probs_.front();
+  }
+  return probs_[std::min<uint64_t>(window - first_window_, probs_.size() - 1)];
+}
@@ -0,0 +1,72 @@
+//
+//  vad.hpp
+//
+//  Copyright (c) 2019 2025 Andrea Bondavalli. All rights reserved.
+//
+//  This program is free software: you can redistribute it and/or modify
+//  it under the terms of the MIT license
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+//
+
+#ifndef _VAD_HPP_
+#define _VAD_HPP_
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <string>
+#include <vector>
+
+struct whisper_vad_context;
+
+/*
+ * Silero voice activity detection on the captured audio.
+ * The VAD model is loaded once per pipeline and runs on every captured
+ * chunk as it arrives: complete windows are analyzed in one call,
+ * preceded by the last history windows so that the detector starts
+ * every call with some context. The planes are mixed down first.
+ * Positions count the samples fed since the last reset.
+ */
+class Vad {
+public:
+  /* Silero window at 16 kHz */
+  constexpr static size_t window_samples = 512;
+  constexpr static size_t history_windows = 8;
+  /* probabilities kept for lookup */
+  constexpr static size_t max_windows = 256;
+
+  Vad() = default;
+  Vad(const Vad &) = delete;
+  ~Vad() { terminate(); }
+
+  bool init(const std::string &model, float threshold, int n_threads = 1);
+  void terminate();
+  /* forget the audio fed so far, the model is kept */
+  void reset();
+
+  /* analyze the next samples of the planes */
+  void process(const float *const *in, size_t planes, size_t samples);
+  /* speech probability of the window containing position, the last
+     one analyzed if not analyzed yet */
+  float get_probability(uint64_t position) const;
+  bool is_speech(uint64_t position) const {
+    return get_probability(position) >= threshold_;
+  }
+  bool is_enabled() const { return ctx_ != nullptr; }
+  void set_threshold(float threshold) { threshold_ = threshold; }
+
+private:
+  struct whisper_vad_context *ctx_{nullptr};
+  float threshold_{0.5f};
+  /* history windows followed by the samples not analyzed yet */
+  std::vector<float> buffer_;
+  size_t history_{0};
+  /* probabilities of the windows from first_window_ */
+  std::deque<float> probs_;
+  uint64_t first_window_{0};
+};
+
+#endif
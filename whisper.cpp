@@ -11,54 +11,104 @@
 //  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
 //
 
+#include <algorithm>
 #include <boost/algorithm/string.hpp>
 #include <chrono>
 #include <fstream>
 #include <mutex>
-#include <thread>
-
-#include <float.h>
 
+#include "trace.hpp"
 #include "utils.hpp"
 #include "whisper.hpp"
 
-static void whisper_no_log_callback(ggml_log_level level,
-                                    const char* text,
-                                    void* user_data) {}
+namespace {
+/* split of the whisper_full() time between the encoder and the decoder,
+   tracked through the encoder begin and the logits filter callbacks */
+struct PhaseTimer {
+  using clock = std::chrono::steady_clock;
+  enum class Phase { other, encode, decode };
 
-bool Whisper::init() {
-  if (ctx_) {
-    (void)terminate();
+  void to(Phase phase) {
+    auto now = clock::now();
+    std::chrono::duration<double> elapsed = now - mark;
+    if (phase_ == Phase::encode) {
+      encode += elapsed.count();
+      Trace::add("encode", mark, now);
+    } else if (phase_ == Phase::decode) {
+      decode += elapsed.count();
+      Trace::add("decode", mark, now);
+    } else if (mark == start) {
+      /* the log mel spectrogram is computed before the first encode */
+      Trace::add("mel", mark, now);
+    }
+    phase_ = phase;
+    mark = now;
   }
-  output_text_.str("");
-
-  TimeElapsed ts{"whisper:: init"};
 
-  if (config_.get_log_severity() > 1) {
-    whisper_log_set(whisper_no_log_callback, NULL);
+  static bool encoder_begin(struct whisper_context *, struct whisper_state *,
+                            void *data) {
+    static_cast<PhaseTimer *>(data)->to(Phase::encode);
+    return true;
   }
+  static void logits_filter(struct whisper_context *, struct whisper_state *,
+                            const whisper_token_data *, int, float *,
+                            void *data) {
+    auto timer = static_cast<PhaseTimer *>(data);
+    if (timer->phase_ != Phase::decode) {
+      timer->to(Phase::decode);
+    }
+  }
+
+  const clock::time_point start{clock::now()};
+  clock::time_point mark{start};
+  double encode{0};
+  double decode{0};
+
+private:
+  Phase phase_{Phase::other};
+};
+} // namespace
 
-  struct whisper_context_params cparams = whisper_context_default_params();
-  cparams.use_gpu = true;
-  ctx_ =
-      whisper_init_from_file_with_params(config_.get_model().c_str(), cparams);
-  if (!ctx_) {
-    BOOST_LOG_TRIVIAL(fatal)
-        << "whisper::whisper_init_from_file_with_params() failed";
+bool Whisper::init() {
+  prompt_tokens_.clear();
+  committed_ = 0;
+
+  /* the context can be swapped by a reload, a worker provides the
+     current one and a reloaded model keeps the vocabulary */
+  struct whisper_context* ctx = model_.get_context();
+  if (!ctx) {
+    BOOST_LOG_TRIVIAL(fatal) << prefix_ << "model not loaded";
     return false;
   }
+  eot_ = whisper_token_eot(ctx);
 
-  language_ = config_.get_language();
-  if (!whisper_is_multilingual(ctx_)) {
-    if (language_ != "en") {
-      BOOST_LOG_TRIVIAL(warning)
-          << "whisper:: model is not multilingual, ignoring language";
-      language_ = "en";
-    }
+  if (!settings_) {
+    own_settings_.init(config_);
+    settings_ = &own_settings_;
+  }
+  if (!model_.is_multilingual() && settings_->get()->language != "en") {
+    BOOST_LOG_TRIVIAL(warning)
+        << prefix_ << "model is not multilingual, ignoring language";
   }
 
-  whisper_ctx_init_openvino_encoder(
-      ctx_, nullptr, config_.get_openvino_device().c_str(), nullptr);
+  auto &metrics = Metrics::get();
+  pipeline_ = config_.get_pipeline_name().empty()
+                  ? config_.get_device_name()
+                  : config_.get_pipeline_name();
+  auto labels = Metrics::label("pipeline", pipeline_);
+  if (draft_) {
+    labels += "," + Metrics::label("model", "draft");
+  }
+  const std::vector<double> seconds{0.05, 0.1, 0.25, 0.5, 1, 2.5, 5, 10, 30};
+  encode_seconds_ = &metrics.histogram("whisper_alsa_encode_seconds",
+                                       "Whisper encoder time per buffer",
+                                       seconds, labels);
+  decode_seconds_ = &metrics.histogram("whisper_alsa_decode_seconds",
+                                       "Whisper decoder time per buffer",
+                                       seconds, labels);
+  rtf_ = &metrics.histogram(
+      "whisper_alsa_rtf", "Processing time over audio duration per buffer",
+      {0.05, 0.1, 0.2, 0.3, 0.5, 0.75, 1, 1.5, 2, 5}, labels);
   return true;
 }
 
@@ -77,73 +127,180 @@ std::string Whisper::to_timestamp(int64_t t, bool comma) {
   return std::string(buf);
 }
 
-void Whisper::process_result() {
+void Whisper::process_result(const Result& result, int64_t offset,
+                             bool partial) {
+  const whisper_token eot = eot_;
+  const bool use_context = settings_->get()->use_context;
+  std::unique_lock text_lock(text_mutex_);
   prompt_tokens_.clear();
-  const int n_segments = whisper_full_n_segments(ctx_);
-  for (int i = 0; i < n_segments; ++i) {
-    const char* text = whisper_full_get_segment_text(ctx_, i);
-    if (text) {
-      auto t0 = whisper_full_get_segment_t0(ctx_, i);
-      auto t1 = whisper_full_get_segment_t1(ctx_, i);
-
-      const int n_tokens = whisper_full_n_tokens(ctx_, i);
-      for (int j = 0; j < n_tokens; j++) {
-        auto token_text = std::string(whisper_full_get_token_text(ctx_, i, j));
-        whisper_token_data data = whisper_full_get_token_data(ctx_, i, j);
-
-        prompt_tokens_.push_back(data.id);
-        BOOST_LOG_TRIVIAL(debug)
-            << "whisper:: " << to_timestamp(data.t0) << " -> "
-            << to_timestamp(data.t1) << "] token id " << data.id << " ["
-            << token_text << "] prob " << data.p;
+  for (const auto& segment : result) {
+    float probability{0};
+    int text_tokens{0};
+    for (const auto& token : segment.tokens) {
+      if (use_context) {
+        prompt_tokens_.push_back(token.data.id);
+      }
+      if (token.data.id < eot) {
+        probability += token.data.p;
+        text_tokens++;
       }
+      BOOST_LOG_TRIVIAL(debug)
+          << "whisper:: " << to_timestamp(token.data.t0) << " -> "
+          << to_timestamp(token.data.t1) << "] token id " << token.data.id
+          << " [" << token.text << "] prob " << token.data.p;
+    }
+
+    BOOST_LOG_TRIVIAL(info) << prefix_ << "[" << to_timestamp(segment.t0)
+                            << " -> " << to_timestamp(segment.t1)
+                            << "] text [" << segment.text << "] ";
+
+    std::string text = boost::algorithm::trim_left_copy(segment.text);
+    if (text != "[BLANK_AUDIO]") {
+      emit(offset + segment.t0, offset + segment.t1, text,
+           text_tokens ? probability / text_tokens : 0, partial);
+    }
+  }
+}
 
-      BOOST_LOG_TRIVIAL(info) << "whisper:: [" << to_timestamp(t0) << " -> "
-                              << to_timestamp(t1) << "] text [" << text << "] ";
+void Whisper::emit(int64_t t0, int64_t t1, const std::string& text,
+                   float probability, bool partial) {
+  TextSegment segment;
+  segment.pipeline = pipeline_;
+  segment.stream = stream_;
+  /* whisper timestamps are in 10 ms units */
+  segment.t0 = t0 * 10;
+  segment.t1 = t1 * 10;
+  segment.text = text;
+  segment.probability = probability;
+  segment.partial = partial;
+  output_.push(segment);
+}
 
-      if (text[0] == ' ') {
-        text++;
+void Whisper::process_stream_result(const Result& result, int64_t offset,
+                                    int64_t final) {
+  std::string final_text, partial_text;
+  int64_t final_t0{-1}, partial_t0{-1}, partial_t1{0};
+  float final_p{0}, partial_p{0};
+  int final_n{0}, partial_n{0};
+  const whisper_token eot = eot_;
+  const bool use_context = settings_->get()->use_context;
+  std::unique_lock text_lock(text_mutex_);
+  if (!use_context) {
+    /* the context may have been turned off since the last window */
+    prompt_tokens_.clear();
+  }
+  for (const auto& segment : result) {
+    for (const auto& token : segment.tokens) {
+      const whisper_token_data& data = token.data;
+      if (data.id >= eot) {
+        /* special and timestamp tokens */
+        continue;
       }
-      if (std::string(text) != "[BLANK_AUDIO]") {
-        std::unique_lock text_lock(text_mutex_);
-        output_text_ << text << std::endl;
+      int64_t t0 = offset + data.t0;
+      int64_t t1 = offset + data.t1;
+      /* already emitted from the overlapping part of a previous window */
+      if ((t0 + t1) / 2 <= committed_) {
+        continue;
+      }
+      if (t1 <= final && partial_text.empty()) {
+        if (final_t0 < 0)
+          final_t0 = t0;
+        final_text += token.text;
+        final_p += data.p;
+        final_n++;
+        committed_ = t1;
+        if (use_context) {
+          prompt_tokens_.push_back(data.id);
+        }
+      } else {
+        if (partial_t0 < 0)
+          partial_t0 = t0;
+        partial_t1 = t1;
+        partial_text += token.text;
+        partial_p += data.p;
+        partial_n++;
       }
     }
   }
-}
+  /* committed tokens are the context of the following windows */
+  if (prompt_tokens_.size() > max_prompt_tokens) {
+    prompt_tokens_.erase(prompt_tokens_.begin(),
+                         prompt_tokens_.end() - max_prompt_tokens);
+  }
 
-// #define _DEBUG_SAVE_RAW_AUDIO_
+  if (!final_text.empty()) {
+    BOOST_LOG_TRIVIAL(info) << prefix_ << "[" << to_timestamp(final_t0)
+                            << " -> " << to_timestamp(committed_)
+                            << "] text [" << final_text << "] ";
+    emit(final_t0, committed_, boost::algorithm::trim_left_copy(final_text),
+         final_p / final_n, false);
+  }
+  if (!partial_text.empty()) {
+    BOOST_LOG_TRIVIAL(info) << prefix_ << "[" << to_timestamp(partial_t0)
+                            << " -> " << to_timestamp(partial_t1)
+                            << "] partial [" << partial_text << "] ";
+    emit(partial_t0, partial_t1,
+         boost::algorithm::trim_left_copy(partial_text),
+         partial_p / partial_n, true);
+  }
+}
 
-bool Whisper::transribe(const float* in, uint32_t samples_in) {
-  TimeElapsed ts{"whisper:: transribe()"};
-  // run the inference
-  whisper_full_params wparams =
-      whisper_full_default_params(WHISPER_SAMPLING_BEAM_SEARCH);
+whisper_full_params Whisper::get_params(
+    const Worker& worker, const std::vector<whisper_token>& prompt,
+    uint32_t samples, const Settings::Values& settings) {
+  const DecodeLevel& level = worker.overload
+                                 ? worker.overload->get_level()
+                                 : OverloadController::levels[0];
+  whisper_full_params wparams = whisper_full_default_params(
+      level.greedy ? WHISPER_SAMPLING_GREEDY : WHISPER_SAMPLING_BEAM_SEARCH);
 
   wparams.duration_ms = 0;
   wparams.print_progress = false;
   wparams.print_special = false;
   wparams.print_realtime = false;
   wparams.translate = false;
-  wparams.language = language_.c_str();
-  auto hw_concurrency = std::thread::hardware_concurrency();
-  /* dont't compete with the capture loop */
-  wparams.n_threads = (hw_concurrency > 1) ? hw_concurrency - 1 : 1;
+  wparams.language =
+      model_.is_multilingual() ? settings.language.c_str() : "en";
+  /* the scheduler splits the cores among the workers */
+  wparams.n_threads = worker.n_threads;
   wparams.single_segment = false;
   wparams.print_timestamps = true;
-  wparams.no_context = !config_.get_use_context();
-  wparams.prompt_tokens = prompt_tokens_.data();
-  wparams.prompt_n_tokens = prompt_tokens_.size();
-  wparams.token_timestamps = true;
-
-  wparams.vad = config_.get_vad_enabled();
-  wparams.vad_model_path = config_.get_vad_model().c_str();
-  wparams.vad_params.threshold = config_.get_vad_threshold();
-  wparams.vad_params.min_speech_duration_ms = 250;
-  wparams.vad_params.min_silence_duration_ms = 100;
-  wparams.vad_params.max_speech_duration_s = FLT_MAX;
-  wparams.vad_params.speech_pad_ms = 30;
-  wparams.vad_params.samples_overlap = 0.1f;
+  wparams.no_context = !settings.use_context;
+  wparams.prompt_tokens = prompt.data();
+  wparams.prompt_n_tokens = prompt.size();
+  /* the streaming windows are stitched on token timestamps */
+  wparams.token_timestamps = level.token_timestamps || config_.get_stream();
+  wparams.beam_search.beam_size = level.beam_size;
+  wparams.greedy.best_of = level.best_of;
+  if (!level.fallback) {
+    wparams.temperature_inc = 0.0f;
+  }
+  if (level.fit_audio_ctx) {
+    /* 50 encoder positions per second plus a second of margin */
+    wparams.audio_ctx = std::min<uint32_t>(
+        samples / (WHISPER_SAMPLE_RATE / 50) + 50, 1500);
+  }
+
+  /* the buffers are cut on the speech detected in the capture */
+  wparams.vad = false;
+  return wparams;
+}
+
+// #define _DEBUG_SAVE_RAW_AUDIO_
+
+bool Whisper::transribe(Worker& worker, const float* in, uint32_t samples_in,
+                        Result& result) {
+  TimeElapsed ts{prefix_ + "transribe()"};
+  std::vector<whisper_token> prompt;
+  {
+    std::shared_lock text_lock(text_mutex_);
+    prompt = prompt_tokens_;
+  }
+  /* the settings of the buffer, kept to the end of the inference */
+  auto settings = settings_->get();
+  // run the inference
+  whisper_full_params wparams =
+      get_params(worker, prompt, samples_in, *settings);
 
 #ifdef _DEBUG_SAVE_RAW_AUDIO_
   static int counter = 0;
@@ -154,43 +311,66 @@ bool Whisper::transribe(const float* in, uint32_t samples_in) {
 #endif
 
   BOOST_LOG_TRIVIAL(debug) << "whisper:: transribe " << " input samples "
-                           << samples_in;
+                           << samples_in << " worker " << worker.id;
+
+  PhaseTimer timer;
+  wparams.encoder_begin_callback = PhaseTimer::encoder_begin;
+  wparams.encoder_begin_callback_user_data = &timer;
+  wparams.logits_filter_callback = PhaseTimer::logits_filter;
+  wparams.logits_filter_callback_user_data = &timer;
 
-  if (whisper_full(ctx_, wparams, in, samples_in) != 0) {
-    BOOST_LOG_TRIVIAL(fatal) << "whisper:: whisper_full() failed";
+  struct whisper_state* state = worker.state;
+  if (whisper_full_with_state(worker.ctx, state, wparams, in, samples_in) != 0) {
+    BOOST_LOG_TRIVIAL(fatal) << prefix_ << "whisper_full_with_state() failed";
     return false;
   }
+  timer.to(PhaseTimer::Phase::other);
+  encode_seconds_->observe(timer.encode);
+  decode_seconds_->observe(timer.decode);
+  std::chrono::duration<double> elapsed =
+      PhaseTimer::clock::now() - timer.start;
+  double rtf = elapsed.count() * WHISPER_SAMPLE_RATE / samples_in;
+  rtf_->observe(rtf);
+  if (worker.overload) {
+    worker.overload->update(rtf);
+  }
 
-  process_result();
+  /* copy the results out of the worker state */
+  result.clear();
+  const int n_segments = whisper_full_n_segments_from_state(state);
+  for (int i = 0; i < n_segments; ++i) {
+    const char* text = whisper_full_get_segment_text_from_state(state, i);
+    if (!text) {
+      continue;
+    }
+    Segment segment;
+    segment.t0 = whisper_full_get_segment_t0_from_state(state, i);
+    segment.t1 = whisper_full_get_segment_t1_from_state(state, i);
+    segment.text = text;
+    const int n_tokens = whisper_full_n_tokens_from_state(state, i);
+    for (int j = 0; j < n_tokens; j++) {
+      segment.tokens.push_back(
+          {whisper_full_get_token_data_from_state(state, i, j),
+           whisper_full_get_token_text_from_state(worker.ctx, state, i, j)});
+    }
+    result.push_back(std::move(segment));
+  }
 
   if (ts.elapsed() * 16 > samples_in) {
     BOOST_LOG_TRIVIAL(warning)
-        << "whisper:: processing took longer than the audio file duration";
+        << prefix_ << "processing took longer than the audio file duration";
   }
 
   return true;
 }
 
-const std::string Whisper::get_text() {
-  std::shared_lock text_lock(text_mutex_);
-  return output_text_.str();
-}
-
-void Whisper::clear_text() {
-  std::unique_lock text_lock(text_mutex_);
-  output_text_.str("");
-}
-
 void Whisper::segment() {
+  std::unique_lock text_lock(text_mutex_);
   prompt_tokens_.clear();
 }
 
 void Whisper::terminate() {
-  BOOST_LOG_TRIVIAL(debug) << "whisper:: terminate";
-  if (ctx_) {
-    whisper_print_timings(ctx_);
-    whisper_free(ctx_);
-    prompt_tokens_.clear();
-    ctx_ = 0;
-  }
+  BOOST_LOG_TRIVIAL(debug) << prefix_ << "terminate";
+  std::unique_lock text_lock(text_mutex_);
+  prompt_tokens_.clear();
 }
@@ -15,27 +15,93 @@
 #include <sstream>
 #include <whisper.h>
 
+#include "metrics.hpp"
+#include "model.hpp"
+#include "scheduler.hpp"
+#include "settings.hpp"
+#include "sink.hpp"
+
+/*
+ * Transcription of one audio stream: prompt tokens and text of the
+ * stream. The model weights are shared through Model and inference runs
+ * on the whisper_state of a scheduler Worker, results are extracted from
+ * the state so that the worker is free before they are processed.
+ */
 class Whisper {
 public:
-  Whisper(const Config &config) : config_(config){};
+  struct Token {
+    whisper_token_data data;
+    std::string text;
+  };
+  struct Segment {
+    int64_t t0;
+    int64_t t1;
+    std::string text;
+    std::vector<Token> tokens;
+  };
+  using Result = std::vector<Segment>;
+
+  /* a draft stream runs the draft model of a cascade, settings are the
+     runtime settings of the pipeline, the configured ones without */
+  Whisper(const Config &config, Model &model, Output &output,
+          const std::string &label = "", const std::string &stream = "",
+          bool draft = false, const Settings *settings = nullptr)
+      : config_(config), model_(model), output_(output), label_(label),
+        stream_(stream), draft_(draft), settings_(settings),
+        prefix_(std::string(draft ? "whisper:: draft " : "whisper:: ") +
+                (label.empty() ? "" : label + " ")){};
   Whisper(const Whisper &) = delete;
 
   bool init();
-  const std::string get_text();
-  void clear_text();
-  void process_result();
   void terminate();
   void segment();
-  bool transribe(const float *in, uint32_t samples_in);
+  /* run on a worker, can overlap with the processing of earlier results
+     but not with another transribe() when the context is used */
+  bool transribe(Worker &worker, const float *in, uint32_t samples_in,
+                 Result &result);
+  /* buffer starting at offset (10 ms units), segments go to the output,
+     as partial for the provisional text of a draft */
+  void process_result(const Result &result, int64_t offset,
+                      bool partial = false);
+  /* streaming window starting at offset (10 ms units): tokens ending
+     before final are committed, the others are emitted as partial */
+  void process_stream_result(const Result &result, int64_t offset,
+                             int64_t final);
+  int64_t get_committed() const { return committed_; }
+  const std::string &get_label() const { return label_; }
 
 private:
+  constexpr static size_t max_prompt_tokens = 64;
+
   const Config &config_;
+  Model &model_;
+  Output &output_;
+  const std::string label_;
+  /* channel group of the segments */
+  const std::string stream_;
+  const bool draft_{false};
+  const Settings *settings_{nullptr};
+  Settings own_settings_;
+  std::string pipeline_;
+  /* log prefix including the stream label */
+  const std::string prefix_;
   std::string to_timestamp(int64_t t, bool comma = false);
+  void emit(int64_t t0, int64_t t1, const std::string &text,
+            float probability, bool partial);
+  /* decoding parameters at the current overload level */
+  whisper_full_params get_params(const Worker &worker,
+                                 const std::vector<whisper_token> &prompt,
+                                 uint32_t samples,
+                                 const Settings::Values &settings);
 
-  std::string language_;
   std::vector<whisper_token> prompt_tokens_;
-  std::stringstream output_text_;
+  /* end of the last committed token */
+  int64_t committed_{0};
+  /* protects the prompt tokens */
   std::shared_mutex text_mutex_;
-  struct whisper_state *state_;
-  struct whisper_context *ctx_{0};
+  /* end of text token, the other special tokens follow it */
+  whisper_token eot_{0};
+  Histogram *encode_seconds_{nullptr};
+  Histogram *decode_seconds_{nullptr};
+  Histogram *rtf_{nullptr};
 };